@@ -27,15 +27,29 @@
 
 
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <map>
 #include <sstream>
+#include <algorithm>
+#include <limits>
 
 #include "aws_s3.h"
 #include "aws_s3_misc.h"
+#include "aws_s3_pool.h"
+#include "aws_s3_sign.h"
+#include "aws_s3_transfer.h"
+#include "aws_s3_xml.h"
+
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <curlpp/cURLpp.hpp>
 #include <curlpp/Options.hpp>
@@ -43,6 +57,106 @@
 using namespace std;
 
 
+//************************************************************************************************
+// AWS_MappedFile, AWS_MemoryStream
+//************************************************************************************************
+
+bool AWS_MappedFile::Map(const string & path)
+{
+    Unmap();
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    if(st.st_size > 0) {
+        void * m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(m == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(m, st.st_size, MADV_SEQUENTIAL);
+        data = (const char *)m;
+    }
+    size = st.st_size;
+    close(fd);// the mapping remains valid
+    return true;
+}
+
+void AWS_MappedFile::Unmap()
+{
+    if(data != NULL)
+        munmap(const_cast<char *>(data), size);
+    data = NULL;
+    size = 0;
+}
+
+void AWS_MappedFile::WillNeed(size_t offset, size_t length) const
+{
+    if(data == NULL || offset >= size)
+        return;
+    // madvise() requires a page aligned address
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset - offset%page;
+    length = min(length, size - offset) + offset - start;
+    madvise(const_cast<char *>(data) + start, length, MADV_WILLNEED);
+}
+
+
+size_t AWS_MemoryStream::Fill(istream & istrm, size_t maxSize, size_t sizeHint)
+{
+    const size_t kMinFill = 65536;
+    delete mapping;
+    mapping = NULL;
+    data.clear();
+    data.reserve(min(maxSize, max(sizeHint, kMinFill)));
+    size_t n = 0;
+    while(n < maxSize && istrm) {
+        // grow geometrically when the size isn't known in advance
+        if(n == data.size())
+            data.resize(min(maxSize, max(data.capacity(), 2*n)));
+        istrm.read(&data[n], data.size() - n);
+        n += istrm.gcount();
+    }
+    data.resize(n);
+    begin = data.empty()? NULL : &data[0];
+    size = n;
+    Rewind();
+    return n;
+}
+
+bool AWS_MemoryStream::Map(const string & path)
+{
+    Release();
+    mapping = new AWS_MappedFile;
+    if(!mapping->Map(path)) {
+        delete mapping;
+        mapping = NULL;
+        return false;
+    }
+    View(mapping->Data(), mapping->Size());
+    return true;
+}
+
+void AWS_MemoryStream::View(const char * d, size_t n)
+{
+    std::vector<char>().swap(data);
+    begin = d;
+    size = n;
+    Rewind();
+}
+
+void AWS_MemoryStream::Release()
+{
+    delete mapping;
+    mapping = NULL;
+    View(NULL, 0);
+}
+
 //************************************************************************************************
 // AWS_IO
 //************************************************************************************************
@@ -83,18 +197,27 @@ size_t AWS_IO::Write(char * buf, size_t size, size_t nmemb)
 size_t AWS_IO::Read(char * buf, size_t size, size_t nmemb)
 {
     streamsize count = 0;
-    if(istrm) {
-        istrm->read(buf, size*nmemb);
+    if(istrm && chunks) {
+        // Data framed and signed in chunks, see AWS_ChunkedPayload
+        count = chunks->Read(*istrm, buf, size*nmemb);
+        bytesSent = chunks->DataRead();
+    }
+    else if(istrm) {
+        // Never send more than announced, istrm may continue past the data to send.
+        size_t length = size*nmemb;
+        if(bytesToPut != 0 && bytesSent + length > bytesToPut)
+            length = bytesToPut - bytesSent;
+        istrm->read(buf, length);
         count = istrm->gcount();
         bytesSent += count;
-        if(printProgress) {
-            if(bytesToPut == 0)
-                cout << "sent " << bytesSent << " bytes, content size unknown";
-            else
-                cout << "sent " << bytesSent << " bytes, " << 100*bytesSent/bytesToPut << "%";
-            cout << "                        \r";
-            cout.flush();
-        }
+    }
+    if(istrm && printProgress) {
+        if(bytesToPut == 0)
+            cout << "sent " << bytesSent << " bytes, content size unknown";
+        else
+            cout << "sent " << bytesSent << " bytes, " << 100*bytesSent/bytesToPut << "%";
+        cout << "                        \r";
+        cout.flush();
     }
     return count;
 }
@@ -103,27 +226,44 @@ size_t AWS_IO::HandleHeader(char * buf, size_t size, size_t nmemb)
 {
     size_t length = size*nmemb;
 //        cout << "#### HeaderCB, Header received: " << string(buf, length);
-    if(length >= 8 && strncmp(buf, "HTTP/1.1", 8) == 0) {
-        result = string(buf + 9, length - 9);
+    // Line ends are not part of names or values
+    size_t end = length;
+    while(end > 0 && (buf[end-1] == '\n' || buf[end-1] == '\r'))
+        --end;
+    
+    if(length >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+        // Status line, "HTTP/1.1 200 OK". Headers of an earlier response, such
+        // as a 100 Continue, are dropped.
+        size_t c = 5;
+        while(c < end && buf[c] != ' ')
+            ++c;
+        if(c < end)
+            result.assign(buf + c + 1, end - c - 1);
+        else
+            result.clear();
         numResult = strtol(result.c_str(), NULL, 0);
+        headers.Clear();
     }
-    else if(length == 2 && strncmp(buf, "\r\n", 2) == 0) {
+    else if(end == 0) {
         // ignore
     }
     else {
         // Find first occurrence of ':'
         size_t c = 0;
-        while(c < length && buf[c] != ':')
+        while(c < end && buf[c] != ':')
             ++c;
         
-        if(c < length) {
-            string header(buf, c);
-            string data(buf+c+2, length - c - 2);
-            if(data[data.length()-1] == '\n')
-                data.erase(data.length()-1);
-//                cout << "#### HeaderCB, parsed header: " << header << endl;
-//                cout << "#### HeaderCB, parsed header data: " << data << endl;
-            headers.Set(header, data);
+        if(c < end) {
+            size_t value = c + 1;
+            while(value < end && (buf[value] == ' ' || buf[value] == '\t'))
+                ++value;
+            headers.Insert(buf, c, buf + value, end - value);
+            
+            // Size of the body, for progress reporting
+            if(bytesToGet == 0 && numResult/100 == 2 && HeaderView(buf, c).Is("Content-Length")) {
+                for(size_t j = value; j < end && isdigit(buf[j]); ++j)
+                    bytesToGet = bytesToGet*10 + (buf[j] - '0');
+            }
         }
         else {
             cerr << "#### ERROR: HeaderCB, unknown header received: " << string(buf, length);
@@ -140,9 +280,8 @@ std::ostream & operator<<(std::ostream & ostrm, AWS_IO & io)
 {
     ostrm << "result: " << io.result << std::endl;
     ostrm << "headers:" << std::endl;
-    AWS_MultiDict::iterator i;
-    for(i = io.headers.begin(); i != io.headers.end(); ++i)
-        ostrm << i->first << ": " << i->second << std::endl;
+    for(size_t j = 0; j < io.headers.Size(); ++j)
+        ostrm << io.headers.Name(j) << ": " << io.headers.Value(j) << std::endl;
     return ostrm;
 }
 
@@ -150,70 +289,124 @@ std::ostream & operator<<(std::ostream & ostrm, AWS_IO & io)
 // AWS
 //************************************************************************************************
 
+// S3 limits on multipart uploads
+const size_t kMinPartSize = 5*1024*1024;
+const size_t kMaxParts = 10000;
+
+// Smallest range GetObjectRanges() fetches, so that a small part size does not
+// turn a download into a flood of tiny requests and journal entries.
+const size_t kMinRangeSize = 1024*1024;
+
+// Number of times a failed part is attempted before giving up on the upload.
+const int kPartAttempts = 3;
+
+// Room for a digest in base 64, as sent in Content-MD5
+const size_t kContentMD5Size = (EVP_MAX_MD_SIZE + 2)/3*4;
+
+static void SetContentMD5(AWS_Headers & headers, const uint8_t * md5, size_t mdLen)
+{
+    char b64[kContentMD5Size];
+    size_t b64Len = EncodeB64(b64, md5, mdLen);
+    headers.Set("Content-MD5", 11, b64, b64Len);
+}
+
 AWS::AWS(const string & kid, const string & sk):
     keyID(kid), secret(sk),
-    verbosity(0)
+    verbosity(0),
+    multipartThreshold(64*1024*1024),
+    partSize(16*1024*1024),
+    partJobs(4),
+    listJobs(4),
+    connections(new AWS_ConnectionPool),
+    endpoint("https://s3.amazonaws.com"),
+    pathStyle(false),
+    signatureVersion(4),
+    signer(new AWS_SigV4(kid, sk))
 {
 }
 
 AWS::~AWS()
 {
-    // Teardown connections, etc
+    delete connections;
+    delete signer;
 }
 
 
-void AWS::ParseBucketsList(list<AWS_S3_Bucket> & buckets, const string & xml)
+void AWS::SetEndpoint(const string & e, bool ps)
 {
-    string::size_type crsr = 0;
-    string data;
-    string name, date;
-    string ownerName, ownerID;
-    ExtractXML(ownerID, crsr, "ID", xml);
-    ExtractXML(ownerName, crsr, "DisplayName", xml);
-    
-    while(ExtractXML(data, crsr, "Name", xml))
-    {
-        name = data;
-        if(ExtractXML(data, crsr, "CreationDate", xml))
-            date = data;
-        else
-            date = "";
-        buckets.push_back(AWS_S3_Bucket(name, date));
+    endpoint = (e.find("://") == string::npos)? "https://" + e : e;
+    while(!endpoint.empty() && endpoint[endpoint.length()-1] == '/')
+        endpoint.erase(endpoint.length()-1);
+    pathStyle = ps;
+}
+
+// Bucket names usable as a host name label: 3 to 63 lower case letters, digits,
+// '-' and '.', with a letter or digit at the start, end, and before each '-' or
+// '.'. Checked conservatively, any other name works path-style.
+static bool HostCompatible(const string & bkt)
+{
+    if(bkt.length() < 3 || bkt.length() > 63)
+        return false;
+    bool prevAlnum = false;
+    for(size_t j = 0; j < bkt.length(); ++j) {
+        char c = bkt[j];
+        bool alnum = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+        if(!alnum && ((c != '-' && c != '.') || !prevAlnum || j == bkt.length() - 1))
+            return false;
+        prevAlnum = alnum;
     }
+    return true;
 }
 
-void AWS::ParseObjectsList(list<AWS_S3_Object> & objects, const string & xml)
+void AWS::AppendBucketURL(string & url, const string & bkt) const
 {
-    string::size_type crsr = 0;
-    string data;
-    
-    while(ExtractXML(data, crsr, "Key", xml))
-    {
-        AWS_S3_Object obj;
-        obj.key = data;
-        
-        if(ExtractXML(data, crsr, "LastModified", xml))
-            obj.lastModified = data;
-        if(ExtractXML(data, crsr, "ETag", xml)) {
-			// eTag starts and ends with &quot;, remove these
-            //obj.eTag = data;
-			obj.eTag = data.substr(6, data.size() - 12);
-		}
-        if(ExtractXML(data, crsr, "Size", xml))
-            obj.size = data;
-        
-        if(ExtractXML(data, crsr, "ID", xml))
-            obj.ownerID = data;
-        if(ExtractXML(data, crsr, "DisplayName", xml))
-            obj.ownerDisplayName = data;
-        
-        if(ExtractXML(data, crsr, "StorageClass", xml))
-            obj.storageClass = data;
-        
-        objects.push_back(obj);
+    // The TLS certificate for *.ENDPOINT does not cover names with more labels
+    bool https = endpoint.compare(0, 8, "https://") == 0;
+    if(pathStyle || !HostCompatible(bkt) || (https && bkt.find('.') != string::npos)) {
+        url.append(endpoint);
+        url.append(1, '/');
+        url.append(bkt);
+    }
+    else {
+        string::size_type host = endpoint.find("://") + 3;
+        url.append(endpoint, 0, host);
+        url.append(bkt);
+        url.append(1, '.');
+        url.append(endpoint, host, string::npos);
     }
 }
 
+string AWS::BucketURL(const string & bkt) const
+{
+    string url;
+    AppendBucketURL(url, bkt);
+    return url;
+}
+
+// Formatted with a single allocation, for the requests on small objects
+string AWS::ObjectURL(const string & bkt, const string & key) const
+{
+    string url;
+    url.reserve(endpoint.length() + bkt.length() + key.length() + 2);
+    AppendBucketURL(url, bkt);
+    url.append(1, '/');
+    url.append(key);
+    return url;
+}
+
+
+void AWS::ParseBucketsList(list<AWS_S3_Bucket> & buckets, const string & xml)
+{
+    AWS_BucketListParser parser(buckets);
+    parser.Parse(xml);
+}
+
+void AWS::ParseObjectsList(AWS_S3_Catalog & objects, const string & xml)
+{
+    AWS_ObjectListParser parser(objects);
+    parser.Parse(xml);
+}
+
 std::list<AWS_S3_Bucket> & AWS::GetBuckets(bool getContents, bool refresh,
                                            AWS_Connection ** conn)
 {
@@ -224,12 +417,10 @@ std::list<AWS_S3_Bucket> & AWS::GetBuckets(bool getContents, bool refresh,
 
 void AWS::RefreshBuckets(bool getContents, AWS_Connection ** conn)
 {
-    std::ostringstream bucketList;
-    AWS_IO io(NULL, &bucketList);
-    ListBuckets(io, conn);
-    
     buckets.clear();
-    ParseBucketsList(buckets, bucketList.str());
+    AWS_BucketListParser parser(buckets);
+    AWS_XMLIO io(parser);
+    ListBuckets(io, conn);
     
     if(getContents) {
         list<AWS_S3_Bucket>::iterator bkt;
@@ -238,148 +429,377 @@ void AWS::RefreshBuckets(bool getContents, AWS_Connection ** conn)
     }
 }
 
-void AWS::GetBucketContents(AWS_S3_Bucket & bucket, AWS_Connection ** conn)
+bool AWS::GetBucketContents(AWS_S3_Bucket & bucket, AWS_Connection ** conn)
 {
-    std::ostringstream objectList;
-    AWS_IO io(NULL, &objectList);
-    ListBucket(bucket.name, io, conn);
-    ParseObjectsList(bucket.objects, objectList.str());
+    return GetBucketContents(bucket, "", "", conn);
 }
 
+// Each page is parsed as it is received, directly into bucket.objects.
+bool AWS::GetBucketContents(AWS_S3_Bucket & bucket, const string & prefix,
+                            const string & delimiter, AWS_Connection ** conn)
+{
+    // Full listings of more than one page are split up and fetched in parallel
+    if(delimiter == "" && listJobs > 1)
+        return ListBucketParallel(bucket, prefix, conn);
+    
+    string marker;
+    bool done = false, ok = true;
+    while(!done)
+    {
+        AWS_ObjectListParser page(bucket.objects, &bucket.commonPrefixes);
+        AWS_XMLIO io(page);
+        ListBucket(bucket.name, prefix, marker, delimiter, 0, io, conn);
+        
+        if(io.Failure() || page.Failed()) {
+            ok = false;
+            done = true;
+        }
+        else if(!page.truncated) {
+            done = true;
+        }
+        else if(page.Marker() == "" || page.Marker() == marker) {
+            // Truncated, but no way to continue
+            ok = false;
+            done = true;
+        }
+        else {
+            marker = page.Marker();
+        }
+    }
+    return ok;
+}
+
+bool AWS::GetObjectInfo(AWS_S3_Bucket & bucket, const string & key, AWS_Connection ** conn)
+{
+    AWS_S3_Catalog page;
+    AWS_ObjectListParser parser(page);
+    AWS_XMLIO io(parser);
+    ListBucket(bucket.name, key, "", "", 1, io, conn);
+    if(io.Failure() || parser.Failed() || page.empty() || page[0].GetKey() != key)
+        return false;
+    bucket.objects.Append(page);
+    return true;
+}
+
+// Orders x-amz- headers by lower case name, keeping repeated headers in order
+struct AmzHeaderLess {
+    bool operator()(const pair<string, HeaderView> & a, const pair<string, HeaderView> & b) const {
+        return a.first < b.first;
+    }
+};
+
 string AWS::GenRequestSignature(const AWS_IO & io, const string & uri, const string & mthd)
 {
-	std::ostringstream sigstrm;
-    sigstrm << mthd << "\n";
-    sigstrm << io.sendHeaders.GetWithDefault("Content-MD5", "") << "\n";
-    sigstrm << io.sendHeaders.GetWithDefault("Content-Type", "") << "\n";
-    sigstrm << io.httpDate << "\n";
+    string sigText;
+    sigText.reserve(256);
+    sigText += mthd;
+    sigText += '\n';
+    HeaderView value;
+    if(io.sendHeaders.Get("Content-MD5", value))
+        sigText.append(value.data, value.length);
+    sigText += '\n';
+    if(io.sendHeaders.Get("Content-Type", value))
+        sigText.append(value.data, value.length);
+    sigText += '\n';
+    sigText += io.httpDate;
+    sigText += '\n';
     
     // http://docs.amazonwebservices.com/AmazonS3/latest/index.html?RESTAccessPolicy.html
-    // CanonicalizedAmzHeaders
-    // TODO: convert headers into canonicalized form (almost there already):
-    // lower-case (TODO)
-    // sorted lexicographically (natural result from map?)
-    // combine headers of same type
-    // unfold long lines
-    // no space (check)
-    AWS_MultiDict::const_iterator i;
-    for(i = io.sendHeaders.begin(); i != io.sendHeaders.end(); ++i) {
-        if(i->first.substr(0, 6) == "x-amz-")
-            sigstrm << i->first + ":" + i->second << '\n';
-    }
-    sigstrm << "/" << uri;
-
+    // CanonicalizedAmzHeaders: x-amz- headers with lower case names, sorted by
+    // name, repeated headers combined into one with comma separated values.
+    vector<pair<string, HeaderView> > amz;
+    for(size_t j = 0; j < io.sendHeaders.Size(); ++j) {
+        HeaderView name = io.sendHeaders.Name(j);
+        if(name.length < 6 || strncasecmp(name.data, "x-amz-", 6) != 0)
+            continue;
+        string lower(name.data, name.length);
+        for(size_t k = 0; k < lower.length(); ++k)
+            lower[k] = tolower(lower[k]);
+        amz.push_back(make_pair(lower, io.sendHeaders.Value(j)));
+    }
+    stable_sort(amz.begin(), amz.end(), AmzHeaderLess());
+    for(size_t j = 0; j < amz.size(); ++j) {
+        if(j > 0 && amz[j].first == amz[j-1].first) {
+            sigText[sigText.length() - 1] = ',';
+        }
+        else {
+            sigText += amz[j].first;
+            sigText += ':';
+        }
+        sigText.append(amz[j].second.data, amz[j].second.length);
+        sigText += '\n';
+    }
+    sigText += '/';
+    sigText += uri;
+    
     if(verbosity >= 3)
-        cout << "#### sigtext:\n" << sigstrm.str() << "\n#### end sigtext" << endl;
+        cout << "#### sigtext:\n" << sigText << "\n#### end sigtext" << endl;
     
-    return GenerateSignature(secret, sigstrm.str());
+    return GenerateSignature(secret, sigText);
 }
 
+// Callbacks from libcurl, data is the AWS_IO of the request. Exceptions must not
+// pass through libcurl, a handler that throws fails the request.
+
 // read by libcurl...read data to send
-struct ReadDataCB {
-    AWS_IO & io;
-    ReadDataCB(AWS_IO & ioio): io(ioio) {}
-    size_t operator()(char * buf, size_t size, size_t nmemb) {return io.Read(buf, size, nmemb);}
-};
+static size_t ReadDataCB(char * buf, size_t size, size_t nmemb, void * data)
+{
+    try {
+        return ((AWS_IO *)data)->Read(buf, size, nmemb);
+    }
+    catch(...) {
+        return CURL_READFUNC_ABORT;
+    }
+}
 
 // write by libcurl...handle data received
-struct WriteDataCB {
-    AWS_IO & io;
-    WriteDataCB(AWS_IO & ioio): io(ioio) {}
-    size_t operator()(char * buf, size_t size, size_t nmemb) {return io.Write(buf, size, nmemb);}
-};
+static size_t WriteDataCB(char * buf, size_t size, size_t nmemb, void * data)
+{
+    try {
+        return ((AWS_IO *)data)->Write(buf, size, nmemb);
+    }
+    catch(...) {
+        return 0;
+    }
+}
 
 // Handle header data.
 //"The header callback will be called once for each header and
 // only complete header lines are passed on to the callback."
-struct HeaderCB {
-    AWS_IO & io;
-    HeaderCB(AWS_IO & ioio): io(ioio) {}
-    size_t operator()(char * buf, size_t size, size_t nmemb) {return io.HandleHeader(buf, size, nmemb);}
-};
+static size_t HeaderCB(char * buf, size_t size, size_t nmemb, void * data)
+{
+    try {
+        return ((AWS_IO *)data)->HandleHeader(buf, size, nmemb);
+    }
+    catch(...) {
+        return 0;
+    }
+}
 
-void AWS::Send(const string & url, const string & uri, const string & method,
-               AWS_IO & io, AWS_Connection ** reqPtr)
+void AWS_Connection::AddHeader(const HeaderView & name, const HeaderView & value)
+{
+    headerStarts.push_back(headerText.size());
+    headerText.insert(headerText.end(), name.data, name.data + name.length);
+    headerText.push_back(':');
+    // A header with nothing after the colon removes one libcurl would add
+    if(value.length > 0) {
+        headerText.push_back(' ');
+        headerText.insert(headerText.end(), value.data, value.data + value.length);
+    }
+    headerText.push_back('\0');
+}
+
+// Link the header lines, once headerText is complete and will not move
+curl_slist * AWS_Connection::EndHeaders()
+{
+    headerList.resize(headerStarts.size());
+    for(size_t j = 0; j < headerList.size(); ++j) {
+        headerList[j].data = &headerText[headerStarts[j]];
+        headerList[j].next = (j + 1 < headerList.size())? &headerList[j + 1] : NULL;
+    }
+    return headerList.empty()? NULL : &headerList[0];
+}
+
+// Signature Version 4. Adds x-amz-date and x-amz-content-sha256 to the headers
+// to send, and the Authorization header to the request's headers.
+void AWS::SignV4(AWS_Connection & request, AWS_IO & io, const string & url, const string & method)
 {
-    string signature;
-    io.httpDate = HTTP_Date();
-    signature = GenRequestSignature(io, uri, method);
+    char amzDate[17];
+    AWS_SigV4::AmzDate(amzDate, time(NULL));
+    io.sendHeaders.Set("x-amz-date", amzDate);
     
-    if(verbosity >= 2)
-        io.printProgress = true;
+    // Object data is signed in chunks as it is sent, rather than read an extra
+    // time to hash it first. Other bodies are small, and are hashed up front.
+    bool streaming = method == "PUT" && io.bytesToPut > 0 &&
+                     dynamic_cast<AWS_MemoryStream *>(io.istrm) != NULL;
+    if(streaming) {
+        char length[32];
+        snprintf(length, sizeof(length), "%lu", (unsigned long)io.bytesToPut);
+        io.sendHeaders.Set("x-amz-content-sha256", AWS_SigV4::kStreamingPayload);
+        io.sendHeaders.Set("x-amz-decoded-content-length", length);
+        HeaderView encoding;
+        if(!io.sendHeaders.Get("Content-Encoding", encoding))
+            io.sendHeaders.Set("Content-Encoding", "aws-chunked");
+        else if(encoding.length < 11 || strncmp(encoding.data, "aws-chunked", 11) != 0)
+            io.sendHeaders.Set("Content-Encoding", "aws-chunked," + encoding.Str());
+    }
+    else {
+        char hash[65];
+        if(io.istrm == NULL || io.bytesToPut == 0)
+            io.sendHeaders.Set("x-amz-content-sha256", AWS_SigV4::kEmptyPayload);
+        else if(AWS_SigV4::HashPayload(*io.istrm, io.bytesToPut, hash))
+            io.sendHeaders.Set("x-amz-content-sha256", hash);
+        else
+            io.sendHeaders.Set("x-amz-content-sha256", AWS_SigV4::kUnsignedPayload);
+    }
     
-    try {
-        cURLpp::Easy * req;
-        // create new Easy or reset and reuse old one.
-        if(reqPtr == NULL)//no handle, locally create and delete Easy
-            req = new cURLpp::Easy;
-        else {
-            if(*reqPtr == NULL) {
-                // Create new Easy, save in handle
-                req = *reqPtr = new cURLpp::Easy;
-            }
-            else {
-                // reuse old Easy
-                req = *reqPtr;
-                req->reset();
-            }
-        }
-        
-        cURLpp::Easy & request = *req;
-        
-        std::ostringstream authstrm, datestrm, urlstrm;
-        datestrm << "Date: " << io.httpDate;
-        authstrm << "Authorization: AWS " << keyID << ":" << signature;
-        
-        std::list<std::string> headers;
-        headers.push_back(datestrm.str());
-        headers.push_back(authstrm.str());
-        
-        AWS_MultiDict::iterator i;
-        for(i = io.sendHeaders.begin(); i != io.sendHeaders.end(); ++i) {
-            headers.push_back(i->first + ": " + i->second);
-            if(verbosity >= 3)
-                cout << "special header: " << i->first + ": " + i->second << endl;
-        }
+    char signature[65];
+    signer->Sign(method, url, io.sendHeaders, request.authorization, signature);
+    request.AddHeader("Authorization", request.authorization);
+    
+    delete io.chunks;
+    io.chunks = streaming? new AWS_ChunkedPayload(*signer, amzDate, signature, io.bytesToPut) : NULL;
+}
+
+// Set up request for a call of perform(). A handle reused from an earlier request
+// keeps its options, only those that change between requests are set.
+void AWS::Prepare(AWS_Connection & request, const string & url, const string & uri,
+                  const string & method, AWS_IO & io)
+{
+    CURL * handle = request.getHandle();
+    
+    request.BeginHeaders();
+    if(signatureVersion == 4) {
+        SignV4(request, io, url, method);
+    }
+    else {
+        io.httpDate = HTTP_Date();
+        string signature = GenRequestSignature(io, uri, method);
+        request.authorization.assign("AWS ");
+        request.authorization.append(keyID);
+        request.authorization.append(1, ':');
+        request.authorization.append(signature);
+        request.AddHeader("Date", io.httpDate);
+        request.AddHeader("Authorization", request.authorization);
+    }
+    
+    // libcurl supplies a form Content-Type for POSTs, which would not match the signature.
+    if(method == "POST" && !io.sendHeaders.Exists("Content-Type"))
+        request.AddHeader("Content-Type", string());
+    
+    for(size_t j = 0; j < io.sendHeaders.Size(); ++j) {
+        request.AddHeader(io.sendHeaders.Name(j), io.sendHeaders.Value(j));
+        if(verbosity >= 3)
+            cout << "special header: " << io.sendHeaders.Name(j) << ": " << io.sendHeaders.Value(j) << endl;
+    }
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, request.EndHeaders());
+    
+    if(!request.configured) {
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, WriteDataCB);
+        curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, HeaderCB);
+        curl_easy_setopt(handle, CURLOPT_READFUNCTION, ReadDataCB);
         
-        request.setOpt(new cURLpp::Options::WriteFunction(cURLpp::Types::WriteFunctionFunctor(WriteDataCB(io))));
-        request.setOpt(new cURLpp::Options::HeaderFunction(cURLpp::Types::WriteFunctionFunctor(HeaderCB(io))));
+        // Responses are parsed as HTTP/1.1, don't let HTTPS negotiate HTTP/2
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
         
-        if(method == "GET") {
-            request.setOpt(new cURLpp::Options::HttpGet(true));
+        // DNS, TLS sessions and connections are shared by all handles.
+        curl_easy_setopt(handle, CURLOPT_SHARE, AWS_ConnectionPool::Share());
+        request.configured = true;
+    }
+    if(request.io != &io) {
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &io);
+        curl_easy_setopt(handle, CURLOPT_HEADERDATA, &io);
+        curl_easy_setopt(handle, CURLOPT_READDATA, &io);
+        request.io = &io;
+    }
+    
+    if(request.method != method) {
+        // Back to a plain GET, which also clears upload, post and no-body modes
+        curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
+        curl_easy_setopt(handle, CURLOPT_HEADER, 0L);
+        curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+        if(method == "PUT") {
+            curl_easy_setopt(handle, CURLOPT_UPLOAD, 1L);
         }
-        else if(method == "PUT") {
-            request.setOpt(new cURLpp::Options::Upload(true));
-            request.setOpt(new cURLpp::Options::ReadFunction(cURLpp::Types::ReadFunctionFunctor(ReadDataCB(io))));
-            request.setOpt(new cURLpp::Options::InfileSize(io.bytesToPut));
+        else if(method == "POST") {
+            curl_easy_setopt(handle, CURLOPT_POST, 1L);
         }
         else if(method == "HEAD") {
-            request.setOpt(new cURLpp::Options::Header(true));
-            request.setOpt(new cURLpp::Options::NoBody(true));
+            curl_easy_setopt(handle, CURLOPT_HEADER, 1L);
+            curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+        }
+        else if(method != "GET") {
+            curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, method.c_str());
+        }
+        request.method = method;
+    }
+    
+    if(method == "PUT") {
+        size_t bodySize = io.bytesToPut;
+        if(io.chunks != NULL)
+            bodySize = AWS_ChunkedPayload::EncodedLength(io.bytesToPut);
+        curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE, (curl_off_t)bodySize);
+    }
+    else if(method == "POST") {
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)io.bytesToPut);
+    }
+    
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_VERBOSE, (long)(verbosity >= 3));
+}
+
+void AWS::Send(const string & url, const string & uri, const string & method,
+               AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    // Progress output from concurrent requests would be interleaved.
+    if(verbosity >= 2 && io.transfer == NULL)
+        io.printProgress = true;
+    
+    if(io.transfer != NULL)
+    {
+        // Queue on the transfer engine, which takes ownership of the handle and
+        // completes the request asynchronously. reqPtr is not used.
+        AWS_Connection * req = new AWS_Connection;
+        try {
+            Prepare(*req, url, uri, method, io);
+        }
+        catch(cURLpp::RuntimeError & e) {
+            delete req;
+            io.error = true;
+            cerr << "Error: " << e.what() << endl;
+            return;
+        }
+        catch(cURLpp::LogicError & e) {
+            delete req;
+            io.error = true;
+            cerr << "Error: " << e.what() << endl;
+            return;
+        }
+        io.transfer->Add(req, io);
+        return;
+    }
+    
+    // Without a connection from the caller, use one from the pool for this host
+    AWS_Connection * pooled = NULL;
+    try {
+        AWS_Connection * req;
+        if(reqPtr == NULL) {
+            req = pooled = connections->Checkout(url);
         }
         else {
-            request.setOpt(new cURLpp::Options::CustomRequest(method));
+            // Create new connection, save in handle. A reused one keeps its options.
+            if(*reqPtr == NULL)
+                *reqPtr = new AWS_Connection;
+            req = *reqPtr;
         }
         
-        request.setOpt(new cURLpp::Options::Url(url));
-        request.setOpt(new cURLpp::Options::Verbose(verbosity >= 3));
-        request.setOpt(new cURLpp::Options::HttpHeader(headers));
+        AWS_Connection & request = *req;
+        Prepare(request, url, uri, method, io);
         
         io.WillStart();
         request.perform();
+        AWS_ConnectionPool::Count(request.getHandle());
         io.DidFinish();
         
-        // If created new Easy for this call, delete it.
-        if(reqPtr == NULL)
-            delete req;
+        if(pooled != NULL) {
+            // A connection the server is closing is not worth keeping
+            if(io.headers.Find("Connection").Is("close"))
+                delete pooled;
+            else
+                connections->Return(url, pooled);
+        }
     }
     catch(cURLpp::RuntimeError & e) {
+        // A handler that stopped the request itself has already set error.
+        if(!io.error)
+            cerr << "Error: " << e.what() << endl;
         io.error = true;
-        cerr << "Error: " << e.what() << endl;
+        delete pooled;
     }
     catch(cURLpp::LogicError & e) {
         io.error = true;
         cerr << "Error: " << e.what() << endl;
+        delete pooled;
     }
 }
 
@@ -387,41 +807,548 @@ void AWS::Send(const string & url, const string & uri, const string & method,
 void AWS::PutObject(const string & bkt, const string & key, const string & acl,
                     AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key;
-    
     if(acl != "") io.sendHeaders.Set("x-amz-acl", acl);
     
-    istream & fin = *io.istrm;
-    uint8_t md5[EVP_MAX_MD_SIZE];
-    size_t mdLen = ComputeMD5(md5, fin);
-    io.sendHeaders.Set("Content-MD5", EncodeB64(md5, mdLen));
+    // Read the data once, then hash and send it from memory. The source need not
+    // be seekable.
+    AWS_MemoryStream * data = dynamic_cast<AWS_MemoryStream *>(io.istrm);
+    if(data == NULL && io.transfer == NULL) {
+        // Buffered a part at a time, so memory does not grow with the stream
+        istream * istrm = io.istrm;
+        PutObjectStream(bkt, key, acl, *istrm, io);
+        io.istrm = istrm;
+        return;
+    }
+    if(data == NULL) {
+        // A transfer can only hold a stream that fits in memory as one request
+        data = new AWS_MemoryStream;
+        data->Fill(*io.istrm, multipartThreshold);
+        if(io.istrm->bad()) {
+            delete data;
+            io.error = true;
+            cerr << "Error reading data for " << key << endl;
+            return;
+        }
+        if(data->Size() == multipartThreshold && io.istrm->peek() != EOF) {
+            delete data;
+            io.error = true;
+            cerr << "Data for " << key << " is larger than " << HumanSize(multipartThreshold)
+                 << ", too large to send on a transfer" << endl;
+            return;
+        }
+        io.SetOwnedInput(data);
+    }
+    data->Rewind();
     
-    fin.clear();
-    fin.seekg(0, std::ios_base::end);
-    ifstream::pos_type endOfFile = fin.tellg();
-    fin.seekg(0, std::ios_base::beg);
-    ifstream::pos_type startOfFile = fin.tellg();
+    if(!io.sendHeaders.Exists("Content-MD5")) {
+        uint8_t md5[EVP_MAX_MD_SIZE];
+        size_t mdLen = ComputeMD5(md5, data->Data(), data->Size());
+        SetContentMD5(io.sendHeaders, md5, mdLen);
+    }
     
     io.bytesReceived = 0;
-    io.bytesToPut = static_cast<size_t>(endOfFile - startOfFile);
+    io.bytesToPut = data->Size();
     
-    Send(urlstrm.str(), bkt + "/" + key, "PUT", io, reqPtr);
+    Send(ObjectURL(bkt, key), bkt + "/" + key, "PUT", io, reqPtr);
 }
 
 void AWS::PutObject(const string & bkt, const string & key,
                     const string & acl, const string & path,
                     AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    ifstream fin(path.c_str(), ios_base::binary | ios_base::in);
-    if(!fin) {
+    // The file must stay mapped or open until the request completes, which may be
+    // after this returns if io is queued on a transfer.
+    AWS_MemoryStream * data = new AWS_MemoryStream;
+    if(data->Map(path)) {
+        if(io.transfer == NULL && data->Size() >= multipartThreshold) {
+            delete data;
+            PutObjectMultipart(bkt, key, acl, path, io);
+            return;
+        }
+        io.SetOwnedInput(data);
+        PutObject(bkt, key, acl, io, reqPtr);
+        return;
+    }
+    delete data;
+    
+    // Not a regular file, or one that can not be mapped
+    ifstream * fin = new ifstream(path.c_str(), ios_base::binary | ios_base::in);
+    if(!*fin) {
+        delete fin;
+        io.error = true;
         cerr << "Could not read file " << path << endl;
         return;
     }
-    io.istrm = &fin;
+    if(io.transfer == NULL) {
+        PutObjectStream(bkt, key, acl, *fin, io);
+        delete fin;
+        return;
+    }
+    io.SetOwnedInput(fin);
     PutObject(bkt, key, acl, io, reqPtr);
 }
 
+//************************************************************************************************
+// Multipart uploads
+//************************************************************************************************
+
+// One part of a multipart upload. Parts of a file are hashed and sent from their
+// own view of the mapped file, so they can be sent concurrently. Parts of a stream
+// are filled by the caller, and their buffers kept for reuse by later parts.
+// Either way, retries do not go back to the source. Retries itself on failure.
+struct AWS_PartIO: public AWS_IO {
+    AWS & aws;
+    AWS_IO & whole;// progress is reported through the AWS_IO for the whole upload
+    const string & bkt, & key, & uploadId;
+    const AWS_MappedFile * source;// NULL for parts of a stream
+    int partNumber;
+    size_t offset, length;
+    int attempts;
+    AWS_MemoryStream data;
+    char contentMD5[kContentMD5Size];// kept for retries
+    size_t contentMD5Length;
+    string eTag;
+    ostream * journal;// finished parts are recorded here if not NULL
+    
+    AWS_PartIO(AWS & a, AWS_IO & w, const string & b, const string & k, const string & u,
+               const AWS_MappedFile * src, int n, size_t off, size_t len):
+        aws(a), whole(w), bkt(b), key(k), uploadId(u), source(src),
+        partNumber(n), offset(off), length(len),
+        attempts(0), contentMD5Length(0), journal(NULL)
+    {}
+    
+    // Make this the given part of a stream, with data already filled.
+    void Reuse(int n, size_t off, size_t len) {
+        partNumber = n;
+        offset = off;
+        length = len;
+        attempts = 0;
+        contentMD5Length = 0;
+        eTag = "";
+    }
+    
+    void Start(AWS_Transfer * xfer) {
+        Reset();
+        transfer = xfer;
+        ++attempts;
+        if(contentMD5Length == 0) {
+            if(source != NULL) {
+                source->WillNeed(offset, length);
+                data.View(source->Data() + offset, length);
+            }
+            uint8_t md5[EVP_MAX_MD_SIZE];
+            size_t mdLen = ComputeMD5(md5, data.Data(), data.Size());
+            contentMD5Length = EncodeB64(contentMD5, md5, mdLen);
+        }
+        data.Rewind();
+        istrm = &data;
+        bytesToPut = length;
+        sendHeaders.Set("Content-MD5", 11, contentMD5, contentMD5Length);
+        aws.UploadPart(bkt, key, uploadId, partNumber, *this);
+    }
+    
+    virtual void DidFinish() {
+        if(Failure() && attempts < kPartAttempts) {
+            cerr << "Retrying part " << partNumber << " of " << key << endl;
+            Start(transfer);
+            return;
+        }
+        headers.Get("ETag", eTag);
+        if(source != NULL)
+            data.Release();
+        if(Success() && journal != NULL)
+            *journal << "part " << partNumber << " " << eTag << endl;
+        
+        if(Success() && whole.printProgress) {
+            whole.bytesSent += length;
+            if(whole.bytesToPut == 0)
+                cout << "sent " << whole.bytesSent << " bytes";
+            else
+                cout << "sent " << whole.bytesSent << " bytes, " << 100*whole.bytesSent/whole.bytesToPut << "%";
+            cout << "                        \r";
+            cout.flush();
+        }
+    }
+    
+    // Record the finished part's ETag, and its response in whole if it is the
+    // first to fail.
+    void Collect(map<int, string> & partETags, bool & partsOK) {
+        if(Failure()) {
+            if(partsOK) {
+                whole.result = result;
+                whole.headers = headers;
+                whole.response << response.str();
+            }
+            partsOK = false;
+        }
+        partETags[partNumber] = eTag;
+        partNumber = 0;
+    }
+};
+
+// Initiate a multipart upload with the headers in io, returning the upload ID, or
+// "" with the failed response in io.
+static string BeginMultipartUpload(AWS & aws, const string & bkt, const string & key,
+                                   const string & acl, AWS_IO & io)
+{
+    AWS_IO initIO;
+    initIO.sendHeaders = io.sendHeaders;
+    string uploadId = aws.InitiateMultipartUpload(bkt, key, acl, initIO);
+    if(uploadId == "") {
+        io.result = initIO.result;
+        io.headers = initIO.headers;
+        io.response << initIO.response.str();
+        io.error = true;
+    }
+    return uploadId;
+}
+
+// Complete the upload if all parts were sent, otherwise abort it
+static void EndMultipartUpload(AWS & aws, const string & bkt, const string & key,
+                               const string & uploadId, const map<int, string> & partETags,
+                               bool partsOK, AWS_IO & io)
+{
+    if(io.printProgress)
+        cout << endl;
+    
+    if(partsOK) {
+        io.Reset();
+        aws.CompleteMultipartUpload(bkt, key, uploadId, partETags, io);
+        if(io.Success())
+            return;
+    }
+    
+    io.error = true;
+    AWS_IO abortIO;
+    aws.AbortMultipartUpload(bkt, key, uploadId, abortIO);
+}
+
+// Multipart uploads of files record their progress in a journal next to the
+// file, PATH.s3upload:
+// s3put journal
+// object BUCKET/KEY
+// source SIZE MTIME DEVICE INODE
+// partsize SIZE
+// upload UPLOAD_ID
+// part NUMBER ETAG
+// ...
+static const char * kUploadJournalTag = "s3put journal";
+
+// Identity of a local file, which changes if the file is modified or replaced
+static string FileIdentity(const string & path)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return "";
+    ostringstream id;
+    id << st.st_size << " " << st.st_mtime << " " << st.st_dev << " " << st.st_ino;
+    return id.str();
+}
+
+static bool ReadUploadJournal(const string & jpath, const string & object, const string & source,
+                              string & uploadId, size_t & psize, map<int, string> & partETags)
+{
+    ifstream fin(jpath.c_str());
+    string line, word;
+    if(!getline(fin, line) || line != kUploadJournalTag) return false;
+    if(!getline(fin, line) || line != "object " + object) return false;
+    if(!getline(fin, line) || line != "source " + source) return false;
+    if(!getline(fin, line)) return false;
+    istringstream sizestrm(line);
+    if(!(sizestrm >> word >> psize) || word != "partsize" || psize == 0) return false;
+    if(!getline(fin, line) || line.compare(0, 7, "upload ") != 0) return false;
+    uploadId = line.substr(7);
+    
+    while(getline(fin, line)) {
+        istringstream entry(line);
+        int partNumber;
+        string eTag;
+        if(entry >> word >> partNumber >> eTag && word == "part")
+            partETags[partNumber] = eTag;
+    }
+    return uploadId != "";
+}
+
+// An upload is gone once it has been completed or aborted
+static bool UploadInProgress(AWS & aws, const string & bkt, const string & key,
+                             const string & uploadId)
+{
+    AWS_UploadListParser parser;
+    string keyMarker, uploadIdMarker;
+    do {
+        parser.Reset();
+        AWS_XMLIO io(parser);
+        aws.ListMultipartUploads(bkt, key, keyMarker, uploadIdMarker, io);
+        if(io.Failure())
+            return false;
+        list<AWS_UploadListParser::Upload>::iterator upload;
+        for(upload = parser.uploads.begin(); upload != parser.uploads.end(); ++upload)
+            if(upload->key == key && upload->uploadId == uploadId)
+                return true;
+    } while(parser.NextPage(keyMarker, uploadIdMarker));
+    return false;
+}
+
+void AWS::PutObjectMultipart(const string & bkt, const string & key,
+                             const string & acl, const string & path,
+                             AWS_IO & io)
+{
+    AWS_MappedFile source;
+    if(!source.Map(path)) {
+        ifstream fin(path.c_str(), ios_base::binary | ios_base::in);
+        if(!fin) {
+            io.error = true;
+            cerr << "Could not read file " << path << endl;
+            return;
+        }
+        PutObjectStream(bkt, key, acl, fin, io);
+        return;
+    }
+    size_t size = source.Size();
+    
+    // Continue an interrupted upload of the same file to the same object
+    string journalPath = path + ".s3upload";
+    string identity = FileIdentity(path);
+    string uploadId;
+    size_t psize = 0;
+    map<int, string> partETags;
+    bool resume = ReadUploadJournal(journalPath, bkt + "/" + key, identity,
+                                    uploadId, psize, partETags) &&
+                  UploadInProgress(*this, bkt, key, uploadId);
+    ofstream journal;
+    if(resume) {
+        if(io.printProgress)
+            cout << "resuming upload " << uploadId << ", " << partETags.size()
+                 << " parts already sent" << endl;
+        journal.open(journalPath.c_str(), ios_base::out | ios_base::app);
+    }
+    else {
+        partETags.clear();
+        psize = max(partSize, kMinPartSize);
+        if((size + psize - 1)/psize > kMaxParts)
+            psize = (size + kMaxParts - 1)/kMaxParts;
+        
+        uploadId = BeginMultipartUpload(*this, bkt, key, acl, io);
+        if(uploadId == "")
+            return;
+        journal.open(journalPath.c_str(), ios_base::out | ios_base::trunc);
+        journal << kUploadJournalTag << "\n" << "object " << bkt << "/" << key << "\n"
+                << "source " << identity << "\n" << "partsize " << psize << "\n"
+                << "upload " << uploadId << endl;
+    }
+    bool journaled = journal.good();
+    if(!journaled && verbosity >= 1)
+        cerr << "Could not write " << journalPath << ", the upload can not be resumed" << endl;
+    if(verbosity >= 2)
+        cout << "multipart upload " << uploadId << ", " << (size + psize - 1)/psize
+             << " parts of " << HumanSize(psize) << endl;
+    
+    io.bytesToPut = max(size, (size_t)1);
+    io.bytesSent = 0;
+    
+    AWS_Transfer xfer(partJobs);
+    vector<AWS_PartIO *> parts;
+    size_t offset = 0;
+    int partNumber = 1;
+    do {
+        size_t length = min(psize, size - offset);
+        if(partETags.find(partNumber) != partETags.end()) {
+            io.bytesSent += length;// sent before the interruption
+        }
+        else {
+            AWS_PartIO * part = new AWS_PartIO(*this, io, bkt, key, uploadId, &source,
+                                               partNumber, offset, length);
+            if(journaled)
+                part->journal = &journal;
+            parts.push_back(part);
+            part->Start(&xfer);
+        }
+        ++partNumber;
+        offset += length;
+    } while(offset < size);
+    xfer.Finish();
+    
+    bool partsOK = true;
+    vector<AWS_PartIO *>::iterator part;
+    for(part = parts.begin(); part != parts.end(); ++part) {
+        (*part)->Collect(partETags, partsOK);
+        delete *part;
+    }
+    journal.close();
+    
+    if(!partsOK && journaled) {
+        // Keep the parts already sent for the next attempt
+        if(io.printProgress)
+            cout << endl;
+        io.error = true;
+        cerr << "Upload of " << path << " is incomplete, put it again to resume" << endl;
+        return;
+    }
+    
+    EndMultipartUpload(*this, bkt, key, uploadId, partETags, partsOK, io);
+    unlink(journalPath.c_str());
+}
+
+void AWS::PutObjectStream(const string & bkt, const string & key,
+                          const string & acl, istream & istrm, AWS_IO & io)
+{
+    size_t psize = max(partSize, kMinPartSize);
+    string uploadId;
+    
+    // partJobs parts being sent, and one being filled
+    vector<AWS_PartIO *> ring;
+    for(size_t j = 0; j <= partJobs; ++j)
+        ring.push_back(new AWS_PartIO(*this, io, bkt, key, uploadId, NULL, 0, 0, 0));
+    
+    AWS_PartIO * part = ring[0];
+    size_t length = part->data.Fill(istrm, psize);
+    if(istrm.bad()) {
+        io.error = true;
+        cerr << "Error reading data for " << key << endl;
+    }
+    else if(length < psize || istrm.peek() == EOF) {
+        // Fits in one part, send it with a single PUT
+        io.istrm = &part->data;
+        PutObject(bkt, key, acl, io);
+        io.istrm = NULL;
+    }
+    else {
+        uploadId = BeginMultipartUpload(*this, bkt, key, acl, io);
+    }
+    if(uploadId == "") {
+        for(size_t j = 0; j < ring.size(); ++j)
+            delete ring[j];
+        return;
+    }
+    if(verbosity >= 2)
+        cout << "multipart upload " << uploadId << ", parts of " << HumanSize(psize) << endl;
+    
+    io.bytesToPut = 0;// unknown
+    io.bytesSent = 0;
+    
+    AWS_Transfer xfer(partJobs);
+    map<int, string> partETags;
+    bool partsOK = true;
+    int partNumber = 0;
+    size_t offset = 0;
+    while(true) {
+        part->Reuse(++partNumber, offset, length);
+        part->Start(&xfer);
+        offset += length;
+        if(istrm.peek() == EOF)
+            break;
+        if(partNumber == (int)kMaxParts) {
+            cerr << "Stream is longer than " << kMaxParts << " parts of " << HumanSize(psize)
+                 << ", use a larger part size" << endl;
+            partsOK = false;
+            break;
+        }
+        
+        // Wait for a part to finish and refill its buffer
+        part = NULL;
+        while(part == NULL) {
+            for(size_t j = 0; j < ring.size() && part == NULL; ++j)
+                if(!xfer.Queued(*ring[j]))
+                    part = ring[j];
+            if(part == NULL)
+                xfer.Step();
+        }
+        if(part->partNumber != 0)
+            part->Collect(partETags, partsOK);
+        if(!partsOK)
+            break;
+        length = part->data.Fill(istrm, psize, psize);
+        if(istrm.bad()) {
+            cerr << "Error reading data for " << key << endl;
+            partsOK = false;
+            break;
+        }
+    }
+    xfer.Finish();
+    
+    for(size_t j = 0; j < ring.size(); ++j) {
+        if(ring[j]->partNumber != 0)
+            ring[j]->Collect(partETags, partsOK);
+        delete ring[j];
+    }
+    
+    EndMultipartUpload(*this, bkt, key, uploadId, partETags, partsOK, io);
+}
+
+string AWS::InitiateMultipartUpload(const string & bkt, const string & key,
+                                    const string & acl, AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream initResponse;
+    if(io.transfer == NULL)
+        io.ostrm = &initResponse;
+    std::ostringstream urlstrm;
+    urlstrm << BucketURL(bkt) << "/" << key << "?uploads";
+    if(acl != "") io.sendHeaders.Set("x-amz-acl", acl);
+    io.bytesToPut = 0;
+    Send(urlstrm.str(), bkt + "/" + key + "?uploads", "POST", io, reqPtr);
+    
+    string uploadId;
+    if(io.Success())
+        ExtractXML(uploadId, "UploadId", initResponse.str());
+    return uploadId;
+}
+
+void AWS::UploadPart(const string & bkt, const string & key,
+                     const string & uploadId, int partNumber,
+                     AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream urlstrm, uristrm;
+    uristrm << bkt << "/" << key << "?partNumber=" << partNumber << "&uploadId=" << uploadId;
+    urlstrm << BucketURL(bkt) << "/" << key
+            << "?partNumber=" << partNumber << "&uploadId=" << uploadId;
+    
+    if(!io.sendHeaders.Exists("Content-MD5")) {
+        istream & fin = *io.istrm;
+        ifstream::pos_type startOfPart = fin.tellg();
+        uint8_t md5[EVP_MAX_MD_SIZE];
+        size_t mdLen = ComputeMD5(md5, fin, io.bytesToPut);
+        SetContentMD5(io.sendHeaders, md5, mdLen);
+        fin.clear();
+        fin.seekg(startOfPart);
+    }
+    
+    Send(urlstrm.str(), uristrm.str(), "PUT", io, reqPtr);
+}
+
+void AWS::CompleteMultipartUpload(const string & bkt, const string & key,
+                                  const string & uploadId,
+                                  const map<int, string> & partETags,
+                                  AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream body;
+    body << "<CompleteMultipartUpload>";
+    map<int, string>::const_iterator part;
+    for(part = partETags.begin(); part != partETags.end(); ++part)
+        body << "<Part><PartNumber>" << part->first << "</PartNumber><ETag>"
+             << part->second << "</ETag></Part>";
+    body << "</CompleteMultipartUpload>";
+    
+    std::ostringstream urlstrm;
+    urlstrm << BucketURL(bkt) << "/" << key << "?uploadId=" << uploadId;
+    io.SetOwnedInput(new std::istringstream(body.str()));
+    io.bytesToPut = body.str().length();
+    Send(urlstrm.str(), bkt + "/" + key + "?uploadId=" + uploadId, "POST", io, reqPtr);
+    
+    // S3 may report a failure to complete the upload with a 200 response.
+    if(io.transfer == NULL && io.ostrm == &io.response &&
+       io.response.str().find("<Error>") != string::npos)
+        io.error = true;
+}
+
+void AWS::AbortMultipartUpload(const string & bkt, const string & key,
+                               const string & uploadId,
+                               AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream urlstrm;
+    urlstrm << BucketURL(bkt) << "/" << key << "?uploadId=" << uploadId;
+    Send(urlstrm.str(), bkt + "/" + key + "?uploadId=" + uploadId, "DELETE", io, reqPtr);
+}
+
 //************************************************************************************************
 // Objects
 //************************************************************************************************
@@ -429,25 +1356,405 @@ void AWS::PutObject(const string & bkt, const string & key,
 void AWS::GetObject(const string & bkt, const string & key,
                     AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key;
-    Send(urlstrm.str(), bkt + "/" + key, "GET", io, reqPtr);
+    Send(ObjectURL(bkt, key), bkt + "/" + key, "GET", io, reqPtr);
+}
+
+//************************************************************************************************
+// Ranged downloads
+//************************************************************************************************
+
+// Resumable downloads keep the data in PATH.s3part until it is complete, and
+// record finished ranges in a journal, PATH.s3journal:
+// s3get journal
+// object BUCKET/KEY
+// size SIZE
+// etag ETAG
+// done OFFSET LENGTH
+// ...
+// A range is only recorded after its data has been synced to disk.
+static const char * kJournalTag = "s3get journal";
+
+static bool ReadDownloadJournal(const string & jpath, const string & object, size_t size,
+                                const string & eTag, vector<pair<size_t, size_t> > & done)
+{
+    ifstream fin(jpath.c_str());
+    string line;
+    if(!getline(fin, line) || line != kJournalTag) return false;
+    if(!getline(fin, line) || line != "object " + object) return false;
+    ostringstream sizestrm;
+    sizestrm << "size " << size;
+    if(!getline(fin, line) || line != sizestrm.str()) return false;
+    if(!getline(fin, line) || line != "etag " + eTag) return false;
+    
+    while(getline(fin, line)) {
+        istringstream entry(line);
+        string word;
+        size_t offset, length;
+        if(entry >> word >> offset >> length && word == "done" && offset + length <= size)
+            done.push_back(make_pair(offset, length));
+    }
+    return true;
+}
+
+// One byte range of a download, written directly to its place in the file.
+// Retries on failure, resuming after the bytes already written. Once finished,
+// the bytes written are synced and recorded in the journal.
+struct AWS_RangeIO: public AWS_IO {
+    AWS & aws;
+    AWS_IO & whole;// progress is reported through the AWS_IO for the whole download
+    const string & bkt, & key, & eTag;
+    int fd;
+    ostream & journal;
+    size_t offset, length;
+    size_t written;
+    int attempts;
+    
+    AWS_RangeIO(AWS & a, AWS_IO & w, const string & b, const string & k, const string & e,
+                int f, ostream & j, size_t off, size_t len):
+        aws(a), whole(w), bkt(b), key(k), eTag(e), fd(f), journal(j),
+        offset(off), length(len), written(0),
+        attempts(0)
+    {}
+    
+    void Start(AWS_Transfer * xfer) {
+        Reset(NULL, NULL);
+        transfer = xfer;
+        ++attempts;
+        std::ostringstream range;
+        range << "bytes=" << (offset + written) << "-" << (offset + length - 1);
+        sendHeaders.Set("Range", range.str());
+        if(eTag != "")
+            sendHeaders.Set("If-Match", eTag);
+        aws.GetObject(bkt, key, *this);
+    }
+    
+    virtual size_t Write(char * buf, size_t size, size_t nmemb) {
+        size_t count = size*nmemb;
+        // Anything but a partial response would be written to the wrong place.
+        if(numResult != 206 || written + count > length)
+            return 0;
+        if(pwrite(fd, buf, count, offset + written) != (ssize_t)count)
+            return 0;
+        written += count;
+        
+        whole.bytesReceived += count;
+        if(whole.printProgress) {
+            cout << "received " << whole.bytesReceived << " bytes, " << 100*whole.bytesReceived/whole.bytesToGet << "%";
+            cout << "                        \r";
+            cout.flush();
+        }
+        return count;
+    }
+    
+    virtual void DidFinish() {
+        if(written < length && numResult != 412 && attempts < kPartAttempts) {
+            cerr << "Retrying range " << offset << "-" << (offset + length - 1) << " of " << key << endl;
+            Start(transfer);
+            return;
+        }
+        if(written > 0 && numResult != 412 && fsync(fd) == 0) {
+            journal << "done " << offset << " " << written << endl;
+        }
+        if(written < length)
+            error = true;
+    }
+};
+
+void AWS::GetObjectRanges(const string & bkt, const string & key,
+                          const string & path, size_t size, const string & eTag,
+                          AWS_IO & io)
+{
+    string partPath = path + ".s3part";
+    string journalPath = path + ".s3journal";
+    
+    // Resume only if the journal is for this version of the object, and the
+    // partial file is still there.
+    vector<pair<size_t, size_t> > done;
+    struct stat st;
+    bool resume = eTag != "" &&
+                  ReadDownloadJournal(journalPath, bkt + "/" + key, size, eTag, done) &&
+                  stat(partPath.c_str(), &st) == 0 && (size_t)st.st_size == size;
+    
+    int fd;
+    ofstream journal;
+    if(resume) {
+        fd = open(partPath.c_str(), O_WRONLY);
+        journal.open(journalPath.c_str(), ios_base::out | ios_base::app);
+    }
+    else {
+        done.clear();
+        fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd >= 0 && ftruncate(fd, size) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        journal.open(journalPath.c_str(), ios_base::out | ios_base::trunc);
+        journal << kJournalTag << "\n" << "object " << bkt << "/" << key << "\n"
+                << "size " << size << "\n" << "etag " << eTag << endl;
+    }
+    if(fd < 0 || !journal) {
+        io.error = true;
+        cerr << "Could not write file " << partPath << endl;
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+#if defined(__linux__)
+    // Reserve the space up front, rather than failing partway through.
+    if(!resume && posix_fallocate(fd, 0, size) != 0) {
+        io.error = true;
+        cerr << "Could not allocate " << HumanSize(size) << " for " << path << endl;
+        close(fd);
+        unlink(partPath.c_str());
+        unlink(journalPath.c_str());
+        return;
+    }
+#endif
+    
+    // Fetch the gaps between the ranges already done
+    sort(done.begin(), done.end());
+    vector<pair<size_t, size_t> > missing;
+    size_t crsr = 0;
+    for(size_t j = 0; j <= done.size(); ++j) {
+        size_t end = (j < done.size())? done[j].first : size;
+        if(end > crsr)
+            missing.push_back(make_pair(crsr, end - crsr));
+        if(j < done.size())
+            crsr = max(crsr, done[j].first + done[j].second);
+    }
+    
+    size_t missingBytes = 0;
+    for(size_t j = 0; j < missing.size(); ++j)
+        missingBytes += missing[j].second;
+    io.bytesToGet = max(size, (size_t)1);
+    io.bytesReceived = size - missingBytes;
+    if(resume && io.printProgress)
+        cout << "resuming " << partPath << ", " << io.bytesReceived << " bytes already received" << endl;
+    
+    size_t rsize = max(partSize, kMinRangeSize);
+    AWS_Transfer xfer(partJobs);
+    vector<AWS_RangeIO *> ranges;
+    for(size_t j = 0; j < missing.size(); ++j) {
+        size_t end = missing[j].first + missing[j].second;
+        for(size_t offset = missing[j].first; offset < end; offset += rsize) {
+            AWS_RangeIO * range = new AWS_RangeIO(*this, io, bkt, key, eTag, fd, journal,
+                                                  offset, min(rsize, end - offset));
+            ranges.push_back(range);
+            range->Start(&xfer);
+        }
+    }
+    xfer.Finish();
+    if(io.printProgress)
+        cout << endl;
+    
+    // Report the first failure, or the first range if all succeeded.
+    bool rangesOK = true, changed = false;
+    AWS_RangeIO * status = ranges.empty()? NULL : ranges.front();
+    vector<AWS_RangeIO *>::iterator range;
+    for(range = ranges.begin(); range != ranges.end(); ++range) {
+        if((*range)->Failure() && rangesOK) {
+            status = *range;
+            rangesOK = false;
+        }
+        if((*range)->numResult == 412)
+            changed = true;
+    }
+    if(status != NULL) {
+        io.result = status->result;
+        io.numResult = status->numResult;
+        io.headers = status->headers;
+    }
+    else {
+        io.result = "200 OK";// nothing left to fetch
+        io.numResult = 200;
+    }
+    for(range = ranges.begin(); range != ranges.end(); ++range)
+        delete *range;
+    
+    if(close(fd) != 0)
+        rangesOK = false;
+    journal.close();
+    
+    // A plain MD5 ETag can be checked against the whole file. Multipart ETags
+    // depend on the part sizes used for the upload, and can not.
+    const char * tag = eTag.data();
+    size_t tagLength = eTag.length();
+    if(tagLength == 34 && tag[0] == '"') {
+        ++tag;
+        tagLength -= 2;
+    }
+    uint8_t expected[16];
+    if(rangesOK && tagLength == 32 && DecodeHex(expected, tag, tagLength) == 16) {
+        ifstream fin(partPath.c_str(), ios_base::binary | ios_base::in);
+        uint8_t md5[EVP_MAX_MD_SIZE];
+        if(ComputeMD5(md5, fin) != 16 || memcmp(md5, expected, 16) != 0) {
+            cerr << "Downloaded data does not match MD5 " << eTag << " of " << key << endl;
+            rangesOK = false;
+            changed = true;// start over next time
+        }
+    }
+    
+    if(rangesOK && rename(partPath.c_str(), path.c_str()) == 0) {
+        unlink(journalPath.c_str());
+        return;
+    }
+    
+    io.error = true;
+    if(changed) {
+        unlink(partPath.c_str());
+        unlink(journalPath.c_str());
+    }
+    else {
+        cerr << "Partial download kept in " << partPath << ", get it again to resume" << endl;
+    }
+}
+
+// The first request of a download to a file, asking for no more than limit bytes.
+// The body is written to path only if that turns out to be the whole object.
+// Otherwise the request is stopped as soon as the object's size is known.
+struct AWS_FirstGetIO: public AWS_IO {
+    const string & path;
+    size_t limit;
+    size_t objectSize;// from Content-Range, if the response was partial
+    bool tooLarge;
+    ofstream fout;
+    
+    AWS_FirstGetIO(const string & p, size_t l):
+        path(p), limit(l), objectSize(0), tooLarge(false)
+    {}
+    
+    virtual size_t Write(char * buf, size_t size, size_t nmemb) {
+        if(numResult == 416)
+            return size*nmemb;
+        if(numResult/100 == 2 && !fout.is_open()) {
+            if(numResult == 206) {
+                // Content-Range: bytes FIRST-LAST/SIZE
+                const string & range = headers.GetWithDefault("Content-Range", "");
+                string::size_type slash = range.find('/');
+                if(slash != string::npos)
+                    objectSize = strtoul(range.c_str() + slash + 1, NULL, 10);
+                if(objectSize > limit) {
+                    tooLarge = true;
+                    error = true;
+                    return 0;
+                }
+            }
+            fout.open(path.c_str(), ios_base::binary | ios_base::out | ios_base::trunc);
+            if(!fout) {
+                cerr << "Could not write file " << path << endl;
+                error = true;
+                return 0;
+            }
+            ostrm = &fout;
+        }
+        return AWS_IO::Write(buf, size, nmemb);
+    }
+    
+    virtual void DidFinish() {
+        // An empty object has no bytes to ask for, and is fetched again whole.
+        if(numResult == 416) {
+            if(printProgress)
+                cout << endl;
+            return;
+        }
+        AWS_IO::DidFinish();
+    }
+};
+
+void AWS::GetObjectFile(const string & bkt, const string & key, const string & path,
+                        AWS_IO & io)
+{
+    string partPath = path + ".s3part";
+    AWS_FirstGetIO first(partPath, max(multipartThreshold, (size_t)1));
+    first.printProgress = io.printProgress;
+    std::ostringstream range;
+    range << "bytes=0-" << (first.limit - 1);
+    first.sendHeaders.Set("Range", range.str());
+    GetObject(bkt, key, first);
+    if(first.numResult == 416) {
+        first.Reset();
+        first.printProgress = io.printProgress;
+        GetObject(bkt, key, first);
+    }
+    
+    if(first.tooLarge) {
+        GetObjectRanges(bkt, key, path, first.objectSize,
+                        first.headers.GetWithDefault("ETag", ""), io);
+        return;
+    }
+    
+    io.result = first.result;
+    io.numResult = first.numResult;
+    io.headers = first.headers;
+    io.response << first.response.str();
+    io.bytesToGet = first.bytesToGet;
+    io.bytesReceived = first.bytesReceived;
+    io.error = first.error;
+    if(io.Success()) {
+        if(!first.fout.is_open())// empty object
+            first.fout.open(partPath.c_str(), ios_base::binary | ios_base::out | ios_base::trunc);
+        first.fout.close();
+        if(!first.fout || rename(partPath.c_str(), path.c_str()) != 0) {
+            io.error = true;
+            unlink(partPath.c_str());
+        }
+        else {
+            unlink((path + ".s3journal").c_str());// left by an earlier version of the object
+        }
+    }
+    else if(first.fout.is_open()) {
+        // Only remove what this request wrote, a partial ranged download may be
+        // waiting to be resumed.
+        first.fout.close();
+        unlink(partPath.c_str());
+    }
 }
 
 void AWS::GetObjectMData(const string & bkt, const string & key,
                          AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key;
-    Send(urlstrm.str(), bkt + "/" + key, "HEAD", io, reqPtr);
+    Send(ObjectURL(bkt, key), bkt + "/" + key, "HEAD", io, reqPtr);
 }
 
 void AWS::DeleteObject(const string & bkt, const string & key,
                        AWS_IO & io, AWS_Connection ** reqPtr)
 {
+    Send(ObjectURL(bkt, key), bkt + "/" + key, "DELETE", io, reqPtr);
+}
+
+void AWS::DeleteObjects(const string & bkt, const vector<string> & keys,
+                        bool quiet, AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    DeleteObjects(bkt, keys, vector<string>(), quiet, io, reqPtr);
+}
+
+void AWS::DeleteObjects(const string & bkt, const vector<string> & keys,
+                        const vector<string> & versionIds,
+                        bool quiet, AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream body;
+    body << "<?xml version=\"1.0\" encoding=\"UTF-8\"?><Delete>";
+    if(quiet)
+        body << "<Quiet>true</Quiet>";
+    for(size_t j = 0; j < keys.size(); ++j) {
+        body << "<Object><Key>" << EncodeXML(keys[j]) << "</Key>";
+        if(j < versionIds.size() && versionIds[j] != "")
+            body << "<VersionId>" << EncodeXML(versionIds[j]) << "</VersionId>";
+        body << "</Object>";
+    }
+    body << "</Delete>";
+    
+    // Content-MD5 is required for this request
+    std::istringstream md5strm(body.str());
+    uint8_t md5[EVP_MAX_MD_SIZE];
+    size_t mdLen = ComputeMD5(md5, md5strm);
+    SetContentMD5(io.sendHeaders, md5, mdLen);
+    
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key;
-    Send(urlstrm.str(), bkt + "/" + key, "DELETE", io, reqPtr);
+    urlstrm << BucketURL(bkt) << "/?delete";
+    io.SetOwnedInput(new std::istringstream(body.str()));
+    io.bytesToPut = body.str().length();
+    Send(urlstrm.str(), bkt + "/?delete", "POST", io, reqPtr);
 }
 
 void AWS::CopyObject(const std::string & srcbkt, const std::string & srckey,
@@ -455,7 +1762,7 @@ void AWS::CopyObject(const std::string & srcbkt, const std::string & srckey,
                      AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream urlstrm;
-    urlstrm << "http://" << dstbkt << ".s3.amazonaws.com/" << dstkey;
+    urlstrm << BucketURL(dstbkt) << "/" << dstkey;
     io.sendHeaders.Set("x-amz-copy-source", string("/") + srcbkt + "/" + srckey);
     io.sendHeaders.Set("x-amz-metadata-directive", copyMD? "COPY" : "REPLACE");
 //    io.sendHeaders["x-amz-copy-source-if-match"] =  etag
@@ -465,34 +1772,255 @@ void AWS::CopyObject(const std::string & srcbkt, const std::string & srckey,
     Send(urlstrm.str(), dstbkt + "/" + dstkey, "PUT", io, reqPtr);
 }
 
+//************************************************************************************************
+// Parallel listing
+//************************************************************************************************
+
+// Object list parser for one partition of the keyspace, dropping keys past its end.
+class AWS_PartitionListParser: public AWS_ObjectListParser {
+  protected:
+    virtual void Object(const AWS_S3_Object & obj) {
+        if(last != "" && obj.key > last)
+            pastEnd = true;
+        else
+            AWS_ObjectListParser::Object(obj);
+    }
+    
+  public:
+    const string & last;
+    bool pastEnd;
+    
+    AWS_PartitionListParser(AWS_S3_Catalog & objs, const string & l):
+        AWS_ObjectListParser(objs), last(l), pastEnd(false)
+    {}
+    
+    virtual void Reset() {
+        AWS_ObjectListParser::Reset();
+        pastEnd = false;
+    }
+};
+
+// Lists the keys after first and up to and including last (or to the end of the
+// bucket if last is empty), one page after another, retrying failed pages.
+struct AWS_ListPartitionIO: public AWS_XMLIO {
+    AWS & aws;
+    const string & bkt, & prefix;
+    string first, last;
+    AWS_S3_Catalog objects;
+    AWS_PartitionListParser page;
+    string marker;
+    int attempts;
+    
+    AWS_ListPartitionIO(AWS & a, const string & b, const string & p,
+                        const string & f, const string & l):
+        AWS_XMLIO(page), aws(a), bkt(b), prefix(p), first(f), last(l),
+        page(objects, last), marker(f), attempts(0)
+    {}
+    
+    void Start(AWS_Transfer * xfer) {
+        Reset();
+        transfer = xfer;
+        ++attempts;
+        page.Reset();
+        aws.ListBucket(bkt, prefix, marker, "", 0, *this);
+    }
+    
+    virtual void DidFinish() {
+        if(Failure() || page.Failed()) {
+            if(attempts < kPartAttempts) {
+                // Pick up after the last complete object received
+                if(!objects.empty())
+                    marker = objects[objects.size() - 1].GetKey();
+                cerr << "Retrying listing of " << bkt << " after \"" << marker << "\"" << endl;
+                Start(transfer);
+                return;
+            }
+            error = true;
+            AWS_IO::DidFinish();
+            return;
+        }
+        
+        if(page.truncated && !page.pastEnd) {
+            if(page.Marker() == "" || page.Marker() == marker) {
+                // Truncated, but no way to continue
+                cerr << "Listing of " << bkt << " truncated after \"" << marker << "\"" << endl;
+                error = true;
+                return;
+            }
+            marker = page.Marker();
+            attempts = 0;
+            Start(transfer);
+        }
+    }
+};
+
+// Find keys to split the listing of bucket under prefix at, after the key after.
+// Keys are grouped by their common prefixes up to the next "/", descending through
+// levels that only contain a single prefix. Where there is nothing to group by, the
+// keyspace is split on the next character.
+static void ListSplitPoints(AWS & aws, const string & bkt, const string & prefix,
+                            const string & after, vector<string> & splits,
+                            AWS_Connection ** conn)
+{
+    // Characters common in keys, in byte order
+    static const char alphabet[] = "-./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz";
+    static const int kMaxDepth = 8;
+    
+    string base = prefix;
+    list<string> prefixes;
+    for(int depth = 0; depth < kMaxDepth; ++depth)
+    {
+        AWS_S3_Catalog objects;
+        prefixes.clear();
+        AWS_ObjectListParser level(objects, &prefixes);
+        AWS_XMLIO io(level);
+        aws.ListBucket(bkt, base, "", "/", 0, io, conn);
+        if(io.Failure() || level.Failed())
+            prefixes.clear();
+        
+        if(prefixes.size() != 1 || !objects.empty() || level.truncated)
+            break;
+        base = prefixes.front();
+        prefixes.clear();
+    }
+    
+    vector<string> candidates;
+    if(prefixes.size() >= 2) {
+        candidates.assign(prefixes.begin(), prefixes.end());
+    }
+    else {
+        for(const char * c = alphabet; *c != '\0'; ++c)
+            candidates.push_back(base + *c);
+    }
+    
+    vector<string>::iterator s;
+    for(s = candidates.begin(); s != candidates.end(); ++s)
+        if(*s > after && (splits.empty() || *s > splits.back()))
+            splits.push_back(*s);
+}
+
+bool AWS::ListBucketParallel(AWS_S3_Bucket & bucket, const string & prefix,
+                             AWS_Connection ** conn)
+{
+    // The first page is fetched directly, small listings end there
+    AWS_ObjectListParser firstPage(bucket.objects);
+    AWS_XMLIO io(firstPage);
+    ListBucket(bucket.name, prefix, "", "", 0, io, conn);
+    if(io.Failure() || firstPage.Failed())
+        return false;
+    if(!firstPage.truncated)
+        return true;
+    
+    string after = firstPage.Marker();
+    if(after == "")
+        return false;
+    
+    vector<string> splits;
+    ListSplitPoints(*this, bucket.name, prefix, after, splits, conn);
+    
+    vector<AWS_ListPartitionIO *> partitions;
+    for(size_t j = 0; j <= splits.size(); ++j) {
+        const string & first = (j == 0)? after : splits[j - 1];
+        const string & last = (j < splits.size())? splits[j] : string();
+        partitions.push_back(new AWS_ListPartitionIO(*this, bucket.name, prefix, first, last));
+    }
+    if(verbosity >= 2)
+        cout << "listing " << bucket.name << " in " << partitions.size() << " partitions" << endl;
+    
+    AWS_Transfer xfer(listJobs);
+    vector<AWS_ListPartitionIO *>::iterator part;
+    for(part = partitions.begin(); part != partitions.end(); ++part)
+        (*part)->Start(&xfer);
+    xfer.Finish();
+    
+    // Partitions are in key order, so the merged listing is too
+    bool ok = true;
+    for(part = partitions.begin(); part != partitions.end(); ++part) {
+        if((*part)->Failure())
+            ok = false;
+        bucket.objects.Append((*part)->objects);
+        delete *part;
+    }
+    return ok;
+}
+
 //************************************************************************************************
 // Buckets
 //************************************************************************************************
 
 void AWS::ListBuckets(AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    Send("http://s3.amazonaws.com/", "", "GET", io, reqPtr);
+    Send(endpoint + "/", "", "GET", io, reqPtr);
 }
 
 void AWS::CreateBucket(const string & bkt, AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com";
+    urlstrm << BucketURL(bkt);
     io.bytesToPut = 0;
     Send(urlstrm.str(), bkt + "/", "PUT", io, reqPtr);
 }
 
 void AWS::ListBucket(const string & bkt, AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    ListBucket(bkt, "", "", "", 0, io, reqPtr);
+}
+
+void AWS::ListBucket(const string & bkt, const string & prefix,
+                     const string & marker, const string & delimiter, int maxKeys,
+                     AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com";
+    urlstrm << BucketURL(bkt);
+    // Listing parameters are not subresources, and are not part of the signed uri
+    std::ostringstream query;
+    if(prefix != "")
+        query << "&prefix=" << URLEncode(prefix);
+    if(marker != "")
+        query << "&marker=" << URLEncode(marker);
+    if(delimiter != "")
+        query << "&delimiter=" << URLEncode(delimiter);
+    if(maxKeys != 0)
+        query << "&max-keys=" << maxKeys;
+    if(query.str() != "")
+        urlstrm << "/?" << query.str().substr(1);
     Send(urlstrm.str(), bkt + "/", "GET", io, reqPtr);
 }
 
+void AWS::ListMultipartUploads(const string & bkt, const string & prefix,
+                               const string & keyMarker, const string & uploadIdMarker,
+                               AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream urlstrm;
+    urlstrm << BucketURL(bkt) << "/?uploads";
+    if(prefix != "")
+        urlstrm << "&prefix=" << URLEncode(prefix);
+    if(keyMarker != "")
+        urlstrm << "&key-marker=" << URLEncode(keyMarker);
+    if(uploadIdMarker != "")
+        urlstrm << "&upload-id-marker=" << URLEncode(uploadIdMarker);
+    Send(urlstrm.str(), bkt + "/?uploads", "GET", io, reqPtr);
+}
+
+void AWS::ListObjectVersions(const string & bkt, const string & prefix,
+                             const string & keyMarker, const string & versionIdMarker,
+                             AWS_IO & io, AWS_Connection ** reqPtr)
+{
+    std::ostringstream urlstrm;
+    urlstrm << BucketURL(bkt) << "/?versions";
+    if(prefix != "")
+        urlstrm << "&prefix=" << URLEncode(prefix);
+    if(keyMarker != "")
+        urlstrm << "&key-marker=" << URLEncode(keyMarker);
+    if(versionIdMarker != "")
+        urlstrm << "&version-id-marker=" << URLEncode(versionIdMarker);
+    Send(urlstrm.str(), bkt + "/?versions", "GET", io, reqPtr);
+}
+
 void AWS::DeleteBucket(const string & bkt, AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com";
+    urlstrm << BucketURL(bkt);
     Send(urlstrm.str(), bkt + "/", "DELETE", io, reqPtr);
 }
 
@@ -505,10 +2033,11 @@ std::string AWS::GetACL(const std::string & bkt, const std::string & key,
                         AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream aclResponse;
-    io.ostrm = &aclResponse;
+    if(io.transfer == NULL)
+        io.ostrm = &aclResponse;
     std::ostringstream urlstrm;
 //    urlstrm << "http://" << bkt << ".s3.amazonaws.com/";
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key << "?acl";
+    urlstrm << BucketURL(bkt) << "/" << key << "?acl";
     Send(urlstrm.str(), bkt + "/" + key + "?acl", "GET", io, reqPtr);
     
     return aclResponse.str();
@@ -517,9 +2046,10 @@ std::string AWS::GetACL(const std::string & bkt, const std::string & key,
 std::string AWS::GetACL(const std::string & bkt, AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream aclResponse;
-    io.ostrm = &aclResponse;
+    if(io.transfer == NULL)
+        io.ostrm = &aclResponse;
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/?acl";
+    urlstrm << BucketURL(bkt) << "/?acl";
     Send(urlstrm.str(), bkt + "/?acl", "GET", io, reqPtr);
     
     return aclResponse.str();
@@ -529,10 +2059,9 @@ std::string AWS::GetACL(const std::string & bkt, AWS_IO & io, AWS_Connection **
 void AWS::SetACL(const std::string & bkt, const std::string & key, const std::string & acl,
                  AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    std::istringstream aclStrm(acl);
-    io.istrm = &aclStrm;
+    io.SetOwnedInput(new std::istringstream(acl));
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key << "?acl";
+    urlstrm << BucketURL(bkt) << "/" << key << "?acl";
     io.bytesToPut = acl.length();
     Send(urlstrm.str(), bkt + "/" + key + "?acl", "PUT", io, reqPtr);
 }
@@ -541,10 +2070,9 @@ void AWS::SetACL(const std::string & bkt, const std::string & key, const std::st
 void AWS::SetACL(const std::string & bkt, const std::string & acl,
                  AWS_IO & io, AWS_Connection ** reqPtr)
 {
-    std::istringstream aclStrm(acl);
-    io.istrm = &aclStrm;
+    io.SetOwnedInput(new std::istringstream(acl));
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/?acl";
+    urlstrm << BucketURL(bkt) << "/?acl";
     io.bytesToPut = acl.length();
     Send(urlstrm.str(), bkt + "/?acl", "PUT", io, reqPtr);
 }
@@ -556,7 +2084,7 @@ void AWS::SetCannedACL(const std::string & bkt, const std::string & key, const s
     // TODO: enforce valid acl, one of:
     // "private", "public-read", "public-read-write", "authenticated-read"
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/" << key << "?acl";
+    urlstrm << BucketURL(bkt) << "/" << key << "?acl";
     io.sendHeaders.Set("x-amz-acl", acl);
     io.bytesToPut = 0;
     Send(urlstrm.str(), bkt + "/" + key + "?acl", "PUT", io, reqPtr);
@@ -567,7 +2095,7 @@ void AWS::SetCannedACL(const std::string & bkt, const std::string & acl,
                  AWS_IO & io, AWS_Connection ** reqPtr)
 {
     std::ostringstream urlstrm;
-    urlstrm << "http://" << bkt << ".s3.amazonaws.com/?acl";
+    urlstrm << BucketURL(bkt) << "/?acl";
     io.sendHeaders.Set("x-amz-acl", acl);
     io.bytesToPut = 0;
     Send(urlstrm.str(), bkt + "/?acl", "PUT", io, reqPtr);
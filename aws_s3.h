@@ -37,9 +37,42 @@
 #include <sstream>
 
 #include <curlpp/Easy.hpp>
-#include "multidict.h"
+#include "aws_s3_headers.h"
+#include "aws_s3_catalog.h"
+#include "aws_s3_sign.h"
 
-typedef cURLpp::Easy AWS_Connection;
+class AWS;
+struct AWS_IO;
+class AWS_Transfer;
+class AWS_ConnectionPool;
+
+// A libcurl handle, and the options AWS::Prepare() last set on it. A reused handle
+// keeps its options between requests, and only the ones that differ are set
+// again. Header lines are formatted into one buffer and linked through nodes kept
+// with the handle, so that a request on a reused handle is prepared without
+// allocating.
+class AWS_Connection: public cURLpp::Easy {
+    friend class AWS;
+    
+    bool configured;// callbacks, HTTP version and share handle set
+    std::string method;// method the handle is set up for, "" if none
+    AWS_IO * io;// target of the callbacks
+    
+    std::string authorization;// signature scratch space
+    std::vector<char> headerText;// "Name: value" lines, each ending with '\0'
+    std::vector<size_t> headerStarts;
+    std::vector<curl_slist> headerList;// nodes pointing into headerText
+    
+    void BeginHeaders() {headerText.clear(); headerStarts.clear();}
+    void AddHeader(const HeaderView & name, const HeaderView & value);
+    void AddHeader(const char * name, const std::string & value) {
+        AddHeader(HeaderView(name, strlen(name)), HeaderView(value.data(), value.length()));
+    }
+    curl_slist * EndHeaders();
+    
+  public:
+    AWS_Connection(): configured(false), io(NULL) {}
+};
 
 // http://docs.amazonwebservices.com/AmazonS3/latest/dev/
 // TODO: requestPayment
@@ -48,6 +81,75 @@ typedef cURLpp::Easy AWS_Connection;
 // TODO: bucket location
 
 
+// Read-only memory mapping of a whole file. Uploads of files are hashed and sent
+// straight from the mapping, which saves copying the data into a stream buffer on
+// the way to libcurl. The file should not be truncated while it is mapped.
+class AWS_MappedFile {
+    const char * data;
+    size_t size;
+    
+    AWS_MappedFile(const AWS_MappedFile &);
+    AWS_MappedFile & operator=(const AWS_MappedFile &);
+  public:
+    AWS_MappedFile(): data(NULL), size(0) {}
+    ~AWS_MappedFile() {Unmap();}
+    
+    // Map the file at path, advising the kernel that it will be read sequentially.
+    // Returns false if the file can not be mapped, if it is a pipe for example.
+    bool Map(const std::string & path);
+    void Unmap();
+    
+    // Advise that a range of the file will be read soon
+    void WillNeed(size_t offset, size_t length) const;
+    
+    const char * Data() const {return data;}
+    size_t Size() const {return size;}
+};
+
+// Input stream over data held in memory: read once from another stream, mapped
+// from a file, or a view of memory owned elsewhere. Data to upload is hashed and
+// then sent (or resent, after Rewind()) from here without reading the source a
+// second time.
+class AWS_MemoryStream: public std::istream {
+    struct Buffer: public std::streambuf {
+        void Set(char * d, size_t n) {setg(d, d, d + n);}
+    };
+    Buffer buf;
+    std::vector<char> data;// contents, if filled from a stream
+    AWS_MappedFile * mapping;// contents, if mapped by Map()
+    const char * begin;
+    size_t size;
+    
+    AWS_MemoryStream(const AWS_MemoryStream &);
+    AWS_MemoryStream & operator=(const AWS_MemoryStream &);
+  public:
+    AWS_MemoryStream(): std::istream(NULL), mapping(NULL), begin(NULL), size(0) {rdbuf(&buf);}
+    ~AWS_MemoryStream() {delete mapping;}
+    
+    // Read from istrm until end of stream or until maxSize bytes have been read,
+    // replacing any previous contents. sizeHint is the expected size, if known.
+    // Returns the number of bytes read, the stream is left positioned at the start.
+    size_t Fill(std::istream & istrm, size_t maxSize, size_t sizeHint = 0);
+    
+    // Map the file at path and read it from the mapping. Returns false if the file
+    // can not be mapped.
+    bool Map(const std::string & path);
+    
+    // Read n bytes at d, which must remain valid while the stream is in use.
+    void View(const char * d, size_t n);
+    
+    const char * Data() const {return begin;}
+    size_t Size() const {return size;}
+    
+    void Rewind() {
+        buf.Set(const_cast<char *>(begin), size);
+        clear();
+    }
+    // Free the buffer or mapping
+    void Release();
+};
+
+
 // AWS_IO objects specify data and headers to send,
 // and collect the data and headers of the response.
 // TODO: this has grown a bit...make a class, add accessors.
@@ -60,20 +162,27 @@ typedef cURLpp::Easy AWS_Connection;
 // Expires: 
 // Cache-Control: 
 // 
-// Content-MD5 is computed by AWS::PutObject().
+// Content-MD5 is computed by AWS::PutObject() and AWS::UploadPart() if not already set.
 // Content-Size for PUT operations is set by libcurl using bytesToPut. Do not specify as a header.
 
 struct AWS_IO {
     std::string httpDate;// Timestamp, set by AWS::Send()
-    AWS_MultiDict sendHeaders;// Headers for request
+    AWS_Headers sendHeaders;// Headers for request
     
     std::string result;// Result code for response, minus the leading "HTTP/1.1"
     int numResult;// Numeric result code for response
-    AWS_MultiDict headers;// Headers from response
+    AWS_Headers headers;// Headers from the last response
     
     std::ostringstream response;// default output stream, contains body of response
     std::istream * istrm;
     std::ostream * ostrm;
+    std::istream * ownedIstrm;// stream opened on the caller's behalf, deleted by Reset()
+    AWS_ChunkedPayload * chunks;// set by AWS::Send() when the data is sent as signed chunks
+    
+    // If set, AWS::Send() queues the request on this transfer engine and returns
+    // immediately. The AWS_IO must then outlive the request, completion is
+    // signalled by a call to DidFinish().
+    AWS_Transfer * transfer;
     
     size_t bytesToGet;// used only for progress reporting
     size_t bytesReceived;
@@ -83,26 +192,39 @@ struct AWS_IO {
     bool printProgress;
     bool error;
     
-    AWS_IO() {Reset();}
-    AWS_IO(std::istream * i) {Reset(i, NULL);}
-    AWS_IO(std::ostream * o) {Reset(NULL, o);}
-    AWS_IO(std::istream * i, std::ostream * o) {Reset(i, o);}
+    AWS_IO(): ownedIstrm(NULL), chunks(NULL) {Reset();}
+    AWS_IO(std::istream * i): ownedIstrm(NULL), chunks(NULL) {Reset(i, NULL);}
+    AWS_IO(std::ostream * o): ownedIstrm(NULL), chunks(NULL) {Reset(NULL, o);}
+    AWS_IO(std::istream * i, std::ostream * o): ownedIstrm(NULL), chunks(NULL) {Reset(i, o);}
+    virtual ~AWS_IO() {delete ownedIstrm; delete chunks;}
     
     void Reset(std::istream * i = NULL, std::ostream * o = NULL) {
         sendHeaders.Clear();
         headers.Clear();
+        response.str("");
         response.clear();
         httpDate = "";
         result = "";
         numResult = 0;
+        delete ownedIstrm;
+        ownedIstrm = NULL;
+        delete chunks;
+        chunks = NULL;
         istrm = NULL;
         ostrm = (o == NULL)? &response : o;
+        transfer = NULL;
         bytesToGet = 0; bytesReceived = 0;
         bytesToPut = 0; bytesSent = 0;
         printProgress = false;
         error = false;
     }
     
+    // Use i as the data to send, deleting it when no longer needed.
+    void SetOwnedInput(std::istream * i) {
+        delete ownedIstrm;
+        ownedIstrm = istrm = i;
+    }
+    
     // "200 OK", or some other 20x message
     bool Success() const {return result[0] == '2' && !error;}
     bool Failure() const {return !Success();}
@@ -126,7 +248,8 @@ struct AWS_IO {
     friend std::ostream & operator<<(std::ostream & ostrm, AWS_IO & io);
 };
 
-// Instances of this class represent objects stored on Amazon S3.
+// Instances of this class represent objects stored on Amazon S3, in the text form
+// they are listed in. Listings are kept in the more compact AWS_S3_Catalog.
 struct AWS_S3_Object {
     std::string key;
     std::string lastModified;
@@ -148,9 +271,8 @@ struct AWS_S3_Bucket {
     std::string name;
     std::string creationDate;
     
-    std::list<AWS_S3_Object> objects;
-    // TODO: object map
-//    std::map<std::string, AWS_S3_Object *> objects;
+    AWS_S3_Catalog objects;
+    std::list<std::string> commonPrefixes;// from listings with a delimiter
     
     AWS_S3_Bucket(const std::string & nm, const std::string & dt): name(nm), creationDate(dt) {}
 };
@@ -160,14 +282,48 @@ class AWS {
     int verbosity;
     std::list<AWS_S3_Bucket> buckets;
     
-    std::string GenRequestSignature(const AWS_IO & io, const std::string & uri, const std::string & mthd);
+    // Multipart upload and ranged download settings
+    size_t multipartThreshold;
+    size_t partSize;
+    size_t partJobs;
+    
+    // Number of parallel requests used by GetBucketContents()
+    size_t listJobs;
+    
+    // Idle connections, reused by requests not given a connection by the caller
+    AWS_ConnectionPool * connections;
+    
+    // Where requests are sent, "https://s3.amazonaws.com" by default
+    std::string endpoint;
+    bool pathStyle;
+    
+    // Signature Version 4 by default, or 2
+    int signatureVersion;
+    AWS_SigV4 * signer;
     
+    // Base URL of a bucket, without a trailing '/'
+    std::string BucketURL(const std::string & bkt) const;
+    void AppendBucketURL(std::string & url, const std::string & bkt) const;
+    std::string ObjectURL(const std::string & bkt, const std::string & key) const;
+    
+    void SignV4(AWS_Connection & request, AWS_IO & io, const std::string & url,
+                const std::string & method);
+    
+    void Prepare(AWS_Connection & request, const std::string & url, const std::string & uri,
+                 const std::string & method, AWS_IO & io);
     void Send(const std::string & url, const std::string & uri,
               const std::string & method, AWS_IO & io, AWS_Connection ** conn);
     
     
     static void ParseBucketsList(std::list<AWS_S3_Bucket> & buckets, const std::string & xml);
-    static void ParseObjectsList(std::list<AWS_S3_Object> & objects, const std::string & xml);
+    static void ParseObjectsList(AWS_S3_Catalog & objects, const std::string & xml);
+    
+    bool ListBucketParallel(AWS_S3_Bucket & bucket, const std::string & prefix,
+                            AWS_Connection ** conn);
+    
+    // Not copyable
+    AWS(const AWS &);
+    AWS & operator=(const AWS &);
     
   public:
     AWS(const std::string & kid, const std::string & sk);
@@ -175,37 +331,165 @@ class AWS {
     
     void SetVerbosity(int v) {verbosity = v;}
     
+    // Files of at least multipartThreshold bytes are uploaded by PutObject() as
+    // multipart uploads, in parts of partSize bytes with up to partJobs parts in
+    // flight at once. The part size is raised if needed to stay within S3's limits.
+    // GetObjectRanges() splits downloads into ranges using the same settings, with
+    // ranges of at least 1 MB.
+    void SetMultipartThreshold(size_t t) {multipartThreshold = t;}
+    void SetPartSize(size_t s) {partSize = s;}
+    void SetPartJobs(size_t j) {partJobs = (j < 1)? 1 : j;}
+    size_t GetMultipartThreshold() const {return multipartThreshold;}
+    
+    // Full listings are split into ranges of keys, listed with up to listJobs
+    // requests in flight at once.
+    void SetListJobs(size_t j) {listJobs = (j < 1)? 1 : j;}
+    
+    // Requests are sent to the endpoint, a host name with an optional port and
+    // scheme ("s3.example.com", "http://localhost:9000"). The scheme defaults to
+    // https. Buckets are normally addressed as host names, BUCKET.ENDPOINT, so
+    // each bucket needs its own connections. With path-style addressing they are
+    // addressed as ENDPOINT/BUCKET, and requests to all buckets share connections
+    // to the endpoint. Bucket names that are not valid host names, or over https
+    // contain dots the certificate would not cover, always use path-style.
+    void SetEndpoint(const std::string & e, bool pathStyle = false);
+    const std::string & GetEndpoint() const {return endpoint;}
+    
+    // Requests are signed with Signature Version 4 for the region, us-east-1 by
+    // default, unless version 2 is selected. Object data sent with version 4 is
+    // signed in chunks as it is sent (see AWS_ChunkedPayload).
+    void SetRegion(const std::string & r) {signer->SetRegion(r);}
+    void SetSignatureVersion(int v) {signatureVersion = (v == 2)? 2 : 4;}
+    
+    // Signature version 2 signature of a request for uri ("bucket/key"), covering
+    // io.httpDate and io.sendHeaders.
+    std::string GenRequestSignature(const AWS_IO & io, const std::string & uri, const std::string & mthd);
+    
+    // Connections kept open between requests, see aws_s3_pool.h.
+    AWS_ConnectionPool & GetConnectionPool() {return *connections;}
+    
     std::list<AWS_S3_Bucket> & GetBuckets(bool getContents, bool refresh,
                                           AWS_Connection ** conn = NULL);
     void RefreshBuckets(bool getContents, AWS_Connection ** conn = NULL);
     
-    void GetBucketContents(AWS_S3_Bucket & bucket, AWS_Connection ** conn = NULL);
-    
-//    void GetObjectInfo(std::string & bktName, std::string & key,
-//                       AWS_S3_Object & bucket, AWS_Connection ** conn = NULL) {
-//        AWS_S3_Bucket bucket(bktName, "");
-//        aws.GetBucketContents(bucket);
-//    }
-    
-    // To perform multiple operations on the same connection, provide a pointer to
+    // Get full listing of bucket, following IsTruncated/NextMarker through as many
+    // pages as needed. Each page is parsed as it is received. Optionally restricted
+    // to keys starting with prefix, and with keys containing delimiter after the
+    // prefix rolled up into bucket.commonPrefixes. Without a delimiter, listings of
+    // more than one page are split at common prefixes and the pieces listed in
+    // parallel (see SetListJobs()), with the result still in key order.
+    // Returns false if a request failed, leaving the listing incomplete.
+    bool GetBucketContents(AWS_S3_Bucket & bucket, AWS_Connection ** conn = NULL);
+    bool GetBucketContents(AWS_S3_Bucket & bucket, const std::string & prefix,
+                           const std::string & delimiter, AWS_Connection ** conn = NULL);
+    
+    // Get the listing entry for a single object, adding it to bucket.objects. This
+    // takes one request, a listing with key as the prefix and max-keys of 1, which
+    // returns the key itself first if it exists. Returns false if the object does
+    // not exist or the request failed.
+    bool GetObjectInfo(AWS_S3_Bucket & bucket, const std::string & key,
+                       AWS_Connection ** conn = NULL);
+    
+    // Connections are kept open and reused for later requests to the same bucket
+    // from the AWS object's connection pool, so operations need not be given one.
+    // To keep a connection to themselves, callers may instead provide a pointer to
     // a pointer to an AWS_Connection as the last parameter, initialized to NULL:
     // AWS_Connection * conn = NULL;
     // PutObject("bucket", "key", io, &conn);
     // PutObject("bucket", "key2", io, &conn);
     // The first operation will create the AWS_Connection. The user should delete
     // the connection themselves after they are done.
+    // 
+    // If io.transfer is set, the operation is queued on that AWS_Transfer instead
+    // and the connection pointer is ignored. See aws_s3_transfer.h.
     
     // Upload object
+    // The data is read once, hashed and sent from memory. If io.istrm is an
+    // AWS_MemoryStream, its contents are used as they are. Other streams are sent by
+    // PutObjectStream(), or if io is queued on a transfer, read into memory, and
+    // refused if longer than the multipart threshold. Files are memory mapped where
+    // possible.
+    // When uploading a file that is at least the multipart threshold in size and
+    // io is not queued on a transfer, PutObjectMultipart() is used. Files that can
+    // not be mapped, such as pipes, are sent by PutObjectStream() in that case.
     void PutObject(const std::string & bkt, const std::string & key, const std::string & acl,
                    AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     void PutObject(const std::string & bkt, const std::string & key,
                    const std::string & acl, const std::string & localpath,
                    AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
+    // Upload file in parts, running several part uploads at once. Headers in
+    // io.sendHeaders are used when initiating the upload. On return, io holds the
+    // response to the final complete (or failed) request. Failed parts are retried.
+    // Parts are sent from a single mapping of the file, files that can not be
+    // mapped are sent as streams.
+    // The upload ID and the ETag of each part sent are recorded in a journal,
+    // localpath.s3upload, along with the file's size, modification time and inode.
+    // If a part can not be sent the upload is left in progress, and a later call for
+    // the same unmodified file and object sends only the missing parts. Without a
+    // journal the upload is aborted instead. The journal is removed once the upload
+    // is completed.
+    void PutObjectMultipart(const std::string & bkt, const std::string & key,
+                            const std::string & acl, const std::string & localpath,
+                            AWS_IO & io);
+    
+    // Upload data from a stream of unknown length, such as standard input or a pipe.
+    // The stream is read into a ring of partJobs + 1 part buffers, each sent as a
+    // part of a multipart upload as soon as it is full, so memory use is bounded by
+    // the part size and not the length of the stream. A stream that ends within the
+    // first part is sent with a single PUT. A multipart upload has at most 10000
+    // parts, which limits the stream to 10000 times the part size.
+    void PutObjectStream(const std::string & bkt, const std::string & key,
+                         const std::string & acl, std::istream & istrm, AWS_IO & io);
+    
+    // Multipart upload steps (POST ?uploads, PUT ?partNumber&uploadId,
+    // POST ?uploadId, DELETE ?uploadId)
+    // InitiateMultipartUpload() returns the upload ID, or "" on failure.
+    // UploadPart() sends io.bytesToPut bytes from the current position of io.istrm,
+    // computing their Content-MD5 first unless io.sendHeaders already has one. The
+    // part's ETag is in the response headers.
+    // partETags maps part numbers to ETags.
+    std::string InitiateMultipartUpload(const std::string & bkt, const std::string & key,
+                                        const std::string & acl, AWS_IO & io,
+                                        AWS_Connection ** reqPtr = NULL);
+    void UploadPart(const std::string & bkt, const std::string & key,
+                    const std::string & uploadId, int partNumber,
+                    AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    void CompleteMultipartUpload(const std::string & bkt, const std::string & key,
+                                 const std::string & uploadId,
+                                 const std::map<int, std::string> & partETags,
+                                 AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    void AbortMultipartUpload(const std::string & bkt, const std::string & key,
+                              const std::string & uploadId,
+                              AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    
     // Get object data (GET /key)
     void GetObject(const std::string & bkt, const std::string & key,
                    AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
+    // Download object of known size to a local file as concurrent ranged GETs,
+    // each written in place into the file, which is first preallocated to size
+    // bytes. If eTag is not empty it is sent as If-Match with every range, so all
+    // come from the same version of the object, and where it is a plain MD5 the
+    // finished file is checked against it.
+    // Data is written to localpath.s3part, and only renamed to localpath once
+    // complete and checked. Finished ranges are recorded, after being synced to
+    // disk, in the journal localpath.s3journal along with the object's size and
+    // ETag. If a download fails the partial file and journal are kept, and a later
+    // call for the same object with the same ETag fetches only the missing ranges.
+    // They are removed if the object has changed.
+    void GetObjectRanges(const std::string & bkt, const std::string & key,
+                         const std::string & localpath, size_t size, const std::string & eTag,
+                         AWS_IO & io);
+    
+    // Download object to a local file, without needing to know its size first.
+    // The first GET asks for at most the multipart threshold; if that is the whole
+    // object it is written to localpath.s3part and renamed to localpath once
+    // complete. Larger objects are fetched by GetObjectRanges(), using the size and
+    // ETag from that first response, so no separate HEAD request is made.
+    void GetObjectFile(const std::string & bkt, const std::string & key,
+                       const std::string & localpath, AWS_IO & io);
+    
     // Get meta-data on object (HEAD)
     // Headers are same as for GetObject(), but no data is retrieved.
     void GetObjectMData(const std::string & bkt, const std::string & key,
@@ -215,6 +499,20 @@ class AWS {
     void DeleteObject(const std::string & bkt, const std::string & key,
                       AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
+    // Delete up to kMaxDeleteKeys objects with one Multi-Object Delete request
+    // (bucket.s3.amazonaws.com POST /?delete). The DeleteResult lists the keys
+    // that were deleted and those that could not be, or in quiet mode only the
+    // latter. It is returned with a 200 status even if some keys failed, so use
+    // an AWS_DeleteResultParser to check it.
+    // The second form deletes specific versions of the objects, with a version ID
+    // for each key, or "" for the current version.
+    static const size_t kMaxDeleteKeys = 1000;
+    void DeleteObjects(const std::string & bkt, const std::vector<std::string> & keys,
+                       bool quiet, AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    void DeleteObjects(const std::string & bkt, const std::vector<std::string> & keys,
+                       const std::vector<std::string> & versionIds,
+                       bool quiet, AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    
     // Copy object (COPY)
     //TODO: copy ACL option
     void CopyObject(const std::string & srcbkt, const std::string & srckey,
@@ -222,19 +520,41 @@ class AWS {
                     AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
     
-    // List buckets (s3.amazonaws.com GET /)
+    // List buckets (ENDPOINT GET /)
     void ListBuckets(AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
     // Create bucket (bucket.s3.amazonaws.com PUT /)
     void CreateBucket(const std::string & bkt, AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
     // List bucket (bucket.s3.amazonaws.com GET /)
+    // Gets one page of at most 1000 keys. The second form lists keys after marker
+    // that start with prefix, at most maxKeys of them if maxKeys is not 0. Empty
+    // parameters are omitted.
     void ListBucket(const std::string & bkt, AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    void ListBucket(const std::string & bkt, const std::string & prefix,
+                    const std::string & marker, const std::string & delimiter, int maxKeys,
+                    AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    
+    // List in-progress multipart uploads (bucket.s3.amazonaws.com GET /?uploads)
+    // Gets one page of at most 1000 uploads of keys starting with prefix, after
+    // keyMarker and uploadIdMarker. Empty parameters are omitted.
+    void ListMultipartUploads(const std::string & bkt, const std::string & prefix,
+                              const std::string & keyMarker, const std::string & uploadIdMarker,
+                              AWS_IO & io, AWS_Connection ** reqPtr = NULL);
+    
+    // List object versions (bucket.s3.amazonaws.com GET /?versions)
+    // Gets one page of at most 1000 versions and delete markers, starting after
+    // keyMarker and versionIdMarker, which are omitted if empty.
+    void ListObjectVersions(const std::string & bkt, const std::string & prefix,
+                            const std::string & keyMarker, const std::string & versionIdMarker,
+                            AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
     // Delete bucket (bucket.s3.amazonaws.com DELETE /)
     void DeleteBucket(const std::string & bkt, AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     
     
+    // When io is queued on a transfer, the ACL is left in io.response instead
+    // of being returned.
     std::string GetACL(const std::string & bkt, const std::string & key,
                        AWS_IO & io, AWS_Connection ** reqPtr = NULL);
     std::string GetACL(const std::string & bkt, AWS_IO & io,
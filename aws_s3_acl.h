@@ -30,7 +30,8 @@
 
 #include <iostream>
 #include <string>
-#include "aws_s3_misc.h"
+#include <list>
+#include "aws_s3_xml.h"
 //******************************************************************************
 
 // A permissions grant
@@ -95,9 +96,9 @@ struct S3_ACL {
     // http://docs.amazonwebservices.com/AmazonS3/latest/index.html?S3_ACLs.html
     // TODO: canonical users
     // TODO: users by e-mail
-//    string ownerDisplayName;
-//    string ownerID;
-//    list<ACL_Grant> grants;
+    std::string ownerDisplayName;
+    std::string ownerID;
+    std::list<ACL_Grant> grants;
     
     ACL_Perms all;
     ACL_Perms auth;
@@ -105,34 +106,47 @@ struct S3_ACL {
     S3_ACL(const std::string & acl);
 };
 
-S3_ACL::S3_ACL(const std::string & acl)
-{
-    std::string::size_type crsr = 0;
-    std::string owner;
-    std::string tmp;
-    crsr = 0;
-//    ExtractXML(owner, crsr, "Owner", acl);
-    ExtractXML(tmp, crsr, "AccessControlList", acl);
+// Collects owner and grants of an AccessControlPolicy
+class ACL_Parser: public AWS_XMLParser {
+    S3_ACL & acl;
+    ACL_Grant grant;
+    
+  protected:
+    virtual void EndElement(const std::string & path, const XMLView & text) {
+        if(PathIs(path, "AccessControlPolicy/Owner/ID"))
+            text.Decode(acl.ownerID);
+        else if(PathIs(path, "AccessControlPolicy/Owner/DisplayName"))
+            text.Decode(acl.ownerDisplayName);
+        else if(PathIs(path, "AccessControlPolicy/AccessControlList/Grant/Grantee/ID"))
+            text.Decode(grant.granteeID);
+        else if(PathIs(path, "AccessControlPolicy/AccessControlList/Grant/Grantee/DisplayName"))
+            text.Decode(grant.granteeDisplayName);
+        else if(PathIs(path, "AccessControlPolicy/AccessControlList/Grant/Grantee/URI"))
+            text.Decode(grant.granteeURI);
+        else if(PathIs(path, "AccessControlPolicy/AccessControlList/Grant/Permission"))
+            text.Decode(grant.permission);
+        else if(PathIs(path, "AccessControlPolicy/AccessControlList/Grant")) {
+            acl.grants.push_back(grant);
+            grant = ACL_Grant();
+        }
+    }
     
-//    ExtractXML(ownerID, "ID", owner);
-//    ExtractXML(ownerDisplayName, "DisplayName", owner);
+  public:
+    ACL_Parser(S3_ACL & a): acl(a) {}
+};
+
+inline S3_ACL::S3_ACL(const std::string & aclXML)
+{
+    ACL_Parser parser(*this);
+    parser.Parse(aclXML);
     
-    crsr = 0;
-    std::string grant;
-    while(ExtractXML(grant, crsr, "Grant", tmp))
+    std::list<ACL_Grant>::iterator g;
+    for(g = grants.begin(); g != grants.end(); ++g)
     {
-        // XML parser isn't smart enough to parse Grantee tags, but this should work.
-        ACL_Grant g;
-        //ExtractXML(g.granteeID, "ID", grant);
-        //ExtractXML(g.granteeDisplayName, "DisplayName", grant);
-        ExtractXML(g.granteeURI, "URI", grant);
-        ExtractXML(g.permission, "Permission", grant);
-        //grants.push_back(g);
-        
-        if(g.granteeURI == "http://acs.amazonaws.com/groups/global/AllUsers")
-            all = ACL_Perms(g.permission);
-        else if(g.granteeURI == "http://acs.amazonaws.com/groups/global/AuthenticatedUsers")
-            auth = ACL_Perms(g.permission);
+        if(g->granteeURI == "http://acs.amazonaws.com/groups/global/AllUsers")
+            all = ACL_Perms(g->permission);
+        else if(g->granteeURI == "http://acs.amazonaws.com/groups/global/AuthenticatedUsers")
+            auth = ACL_Perms(g->permission);
     }
 }
 
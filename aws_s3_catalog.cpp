@@ -0,0 +1,358 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <sstream>
+
+#include "aws_s3_catalog.h"
+#include "aws_s3.h"
+#include "aws_s3_codec.h"
+
+using namespace std;
+
+//******************************************************************************
+// Conversions between the text fields of listings and their binary form
+//******************************************************************************
+
+// Days from 1970-01-01 to the given date in the proleptic Gregorian calendar
+static int64_t DaysFromCivil(int64_t y, int m, int d)
+{
+    y -= (m <= 2);
+    int64_t era = ((y >= 0)? y : y - 399)/400;
+    int64_t yoe = y - era*400;
+    int64_t doy = (153*(m + ((m > 2)? -3 : 9)) + 2)/5 + d - 1;
+    int64_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return era*146097 + doe - 719468;
+}
+
+// Done by hand, sscanf() and timegm() cost more than the rest of a listing entry.
+bool ParseTimestamp(int64_t & ms, const string & str)
+{
+    static const char pattern[] = "dddd-dd-ddTdd:dd:dd";
+    if(str.length() < sizeof(pattern) - 1)
+        return false;
+    for(size_t j = 0; j < sizeof(pattern) - 1; ++j) {
+        if(pattern[j] == 'd') {
+            if(str[j] < '0' || str[j] > '9')
+                return false;
+        }
+        else if(str[j] != pattern[j]) {
+            return false;
+        }
+    }
+    const char * s = str.c_str();
+    int year = (s[0] - '0')*1000 + (s[1] - '0')*100 + (s[2] - '0')*10 + (s[3] - '0');
+    int month = (s[5] - '0')*10 + (s[6] - '0');
+    int day = (s[8] - '0')*10 + (s[9] - '0');
+    int hour = (s[11] - '0')*10 + (s[12] - '0');
+    int minute = (s[14] - '0')*10 + (s[15] - '0');
+    int second = (s[17] - '0')*10 + (s[18] - '0');
+    if(month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return false;
+    int fraction = 0;
+    if(s[19] == '.') {
+        int scale = 100;
+        for(const char * c = s + 20; *c >= '0' && *c <= '9'; ++c, scale /= 10)
+            fraction += (*c - '0')*scale;
+    }
+    int64_t secs = DaysFromCivil(year, month, day)*86400 + hour*3600 + minute*60 + second;
+    ms = secs*1000 + fraction;
+    return true;
+}
+
+static string FormatTimestamp(int64_t ms)
+{
+    time_t secs = (time_t)(ms/1000);
+    struct tm t;
+    gmtime_r(&secs, &t);
+    char buf[32];
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &t);
+    snprintf(buf + len, sizeof(buf) - len, ".%03dZ", (int)(ms%1000));
+    return buf;
+}
+
+static int HexDigit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;// upper case is kept as text, so it is given back unchanged
+}
+
+// Parse an ETag of the form md5 or md5-N, returning false for anything else
+static bool ParseETag(uint8_t md5[16], uint16_t & parts, const string & eTag)
+{
+    if(eTag.length() < 32)
+        return false;
+    for(int j = 0; j < 16; ++j) {
+        int hi = HexDigit(eTag[j*2]), lo = HexDigit(eTag[j*2 + 1]);
+        if(hi < 0 || lo < 0)
+            return false;
+        md5[j] = (hi << 4) | lo;
+    }
+    parts = 0;
+    if(eTag.length() == 32)
+        return true;
+    if(eTag[32] != '-' || eTag.length() == 33 || eTag.length() > 38)
+        return false;
+    unsigned long n = 0;
+    for(size_t j = 33; j < eTag.length(); ++j) {
+        if(eTag[j] < '0' || eTag[j] > '9')
+            return false;
+        n = n*10 + (eTag[j] - '0');
+    }
+    if(n == 0 || n >= AWS_S3_Catalog::kETagText)
+        return false;
+    parts = n;
+    return true;
+}
+
+//******************************************************************************
+// AWS_S3_Catalog
+//******************************************************************************
+
+struct AWS_S3_Catalog::KeyOrder {
+    const AWS_S3_Catalog & catalog;
+    KeyOrder(const AWS_S3_Catalog & c): catalog(c) {}
+    bool operator()(const Entry & a, const Entry & b) const {return catalog.Less(a, b);}
+};
+
+void AWS_S3_Catalog::clear()
+{
+    entries.clear();
+    keys.clear();
+    strings.clear();
+    stringIDs.clear();
+    sorted = true;
+    Intern("");// index 0 is the empty string
+}
+
+uint32_t AWS_S3_Catalog::Intern(const string & str)
+{
+    map<string, uint32_t>::iterator s = stringIDs.find(str);
+    if(s != stringIDs.end())
+        return s->second;
+    uint32_t id = strings.size();
+    strings.push_back(str);
+    stringIDs[str] = id;
+    return id;
+}
+
+// Owner and storage class usually repeat from one object to the next, so check
+// the previous value before searching.
+uint32_t AWS_S3_Catalog::Intern(const string & str, uint32_t previous)
+{
+    return (strings[previous] == str)? previous : Intern(str);
+}
+
+// Byte order, as S3 lists keys
+bool AWS_S3_Catalog::Less(const Entry & a, const Entry & b) const
+{
+    int cmp = memcmp(&keys[a.key], &keys[b.key], min(a.keyLength, b.keyLength));
+    return (cmp != 0)? (cmp < 0) : (a.keyLength < b.keyLength);
+}
+
+void AWS_S3_Catalog::Add(const AWS_S3_Object & obj)
+{
+    Entry entry;
+    entry.key = keys.size();
+    entry.keyLength = obj.key.length();
+    keys.insert(keys.end(), obj.key.begin(), obj.key.end());
+    keys.push_back('\0');
+    
+    entry.size = strtoull(obj.size.c_str(), NULL, 10);
+    entry.lastModified = 0;
+    ParseTimestamp(entry.lastModified, obj.lastModified);
+    const Entry * prev = entries.empty()? NULL : &entries.back();
+    entry.ownerID = Intern(obj.ownerID, prev? prev->ownerID : 0);
+    entry.ownerDisplayName = Intern(obj.ownerDisplayName, prev? prev->ownerDisplayName : 0);
+    entry.storageClass = Intern(obj.storageClass, prev? prev->storageClass : 0);
+    if(!ParseETag(entry.eTag, entry.eTagParts, obj.eTag)) {
+        uint32_t text = Intern(obj.eTag);
+        memset(entry.eTag, 0, sizeof(entry.eTag));
+        memcpy(entry.eTag, &text, sizeof(text));
+        entry.eTagParts = kETagText;
+    }
+    
+    if(sorted && !entries.empty() && !Less(entries.back(), entry))
+        sorted = false;
+    entries.push_back(entry);
+}
+
+void AWS_S3_Catalog::Append(const AWS_S3_Catalog & other)
+{
+    if(other.empty())
+        return;
+    
+    vector<uint32_t> stringMap(other.strings.size());
+    for(size_t j = 0; j < other.strings.size(); ++j)
+        stringMap[j] = Intern(other.strings[j]);
+    
+    size_t keyBase = keys.size();
+    keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+    
+    size_t first = entries.size();
+    entries.reserve(entries.size() + other.entries.size());
+    vector<Entry>::const_iterator e;
+    for(e = other.entries.begin(); e != other.entries.end(); ++e) {
+        Entry entry = *e;
+        entry.key += keyBase;
+        entry.ownerID = stringMap[entry.ownerID];
+        entry.ownerDisplayName = stringMap[entry.ownerDisplayName];
+        entry.storageClass = stringMap[entry.storageClass];
+        if(entry.eTagParts == kETagText) {
+            uint32_t text;
+            memcpy(&text, entry.eTag, sizeof(text));
+            text = stringMap[text];
+            memcpy(entry.eTag, &text, sizeof(text));
+        }
+        entries.push_back(entry);
+    }
+    
+    sorted = sorted && other.sorted && (first == 0 || Less(entries[first - 1], entries[first]));
+}
+
+size_t AWS_S3_Catalog::Find(const string & key) const
+{
+    if(sorted) {
+        size_t lo = 0, hi = entries.size();
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo)/2;
+            const Entry & e = entries[mid];
+            int cmp = memcmp(&keys[e.key], key.data(), min((size_t)e.keyLength, key.length()));
+            if(cmp < 0 || (cmp == 0 && e.keyLength < key.length()))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if(lo < entries.size() && entries[lo].keyLength == key.length() &&
+           memcmp(&keys[entries[lo].key], key.data(), key.length()) == 0)
+            return lo;
+        return npos;
+    }
+    
+    for(size_t j = 0; j < entries.size(); ++j)
+        if(entries[j].keyLength == key.length() &&
+           memcmp(&keys[entries[j].key], key.data(), key.length()) == 0)
+            return j;
+    return npos;
+}
+
+void AWS_S3_Catalog::Sort()
+{
+    if(!sorted)
+        std::stable_sort(entries.begin(), entries.end(), KeyOrder(*this));
+    sorted = true;
+}
+
+size_t AWS_S3_Catalog::MemoryUsed() const
+{
+    size_t total = entries.capacity()*sizeof(Entry) + keys.capacity();
+    for(size_t j = 0; j < strings.size(); ++j)
+        total += sizeof(string) + strings[j].capacity();
+    // roughly, for the map nodes
+    total += stringIDs.size()*(sizeof(string) + 48);
+    return total;
+}
+
+//******************************************************************************
+// AWS_S3_ObjectRef
+//******************************************************************************
+
+const char * AWS_S3_ObjectRef::GetKey() const
+{
+    return &catalog->keys[catalog->entries[idx].key];
+}
+
+size_t AWS_S3_ObjectRef::GetKeyLength() const
+{
+    return catalog->entries[idx].keyLength;
+}
+
+uint64_t AWS_S3_ObjectRef::GetSize() const
+{
+    return catalog->entries[idx].size;
+}
+
+int64_t AWS_S3_ObjectRef::GetLastModifiedMS() const
+{
+    return catalog->entries[idx].lastModified;
+}
+
+string AWS_S3_ObjectRef::GetLastModified() const
+{
+    return FormatTimestamp(catalog->entries[idx].lastModified);
+}
+
+string AWS_S3_ObjectRef::GetETag() const
+{
+    const AWS_S3_Catalog::Entry & entry = catalog->entries[idx];
+    if(entry.eTagParts == AWS_S3_Catalog::kETagText) {
+        uint32_t text;
+        memcpy(&text, entry.eTag, sizeof(text));
+        return catalog->strings[text];
+    }
+    char buf[40];
+    EncodeHex(buf, entry.eTag, 16);
+    buf[32] = '\0';
+    if(entry.eTagParts != 0)
+        snprintf(buf + 32, sizeof(buf) - 32, "-%u", (unsigned)entry.eTagParts);
+    return buf;
+}
+
+const string & AWS_S3_ObjectRef::GetOwnerID() const
+{
+    return catalog->strings[catalog->entries[idx].ownerID];
+}
+
+const string & AWS_S3_ObjectRef::GetOwnerDisplayName() const
+{
+    return catalog->strings[catalog->entries[idx].ownerDisplayName];
+}
+
+const string & AWS_S3_ObjectRef::GetStorageClass() const
+{
+    return catalog->strings[catalog->entries[idx].storageClass];
+}
+
+AWS_S3_Object AWS_S3_ObjectRef::Materialize() const
+{
+    AWS_S3_Object obj;
+    obj.key.assign(GetKey(), GetKeyLength());
+    obj.lastModified = GetLastModified();
+    obj.eTag = GetETag();
+    std::ostringstream size;
+    size << GetSize();
+    obj.size = size.str();
+    obj.ownerID = GetOwnerID();
+    obj.ownerDisplayName = GetOwnerDisplayName();
+    obj.storageClass = GetStorageClass();
+    return obj;
+}
@@ -0,0 +1,145 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_CATALOG_H
+#define AWS_S3_CATALOG_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+struct AWS_S3_Object;
+class AWS_S3_Catalog;
+
+// Parse an S3 timestamp, 2010-06-19T19:48:12.000Z, into milliseconds since the
+// epoch. Returns false, leaving ms unchanged, if str is not in that form.
+bool ParseTimestamp(int64_t & ms, const std::string & str);
+
+// A reference to one object in an AWS_S3_Catalog, valid until the catalog is
+// modified. Text fields are formatted on request.
+class AWS_S3_ObjectRef {
+    const AWS_S3_Catalog * catalog;
+    size_t idx;
+    
+  public:
+    AWS_S3_ObjectRef(const AWS_S3_Catalog * c, size_t i): catalog(c), idx(i) {}
+    
+    const char * GetKey() const;
+    size_t GetKeyLength() const;
+    uint64_t GetSize() const;
+    int64_t GetLastModifiedMS() const;// milliseconds since the epoch
+    std::string GetLastModified() const;// as S3 gives it, 2010-06-19T19:48:12.000Z
+    std::string GetETag() const;// without quotes
+    const std::string & GetOwnerID() const;
+    const std::string & GetOwnerDisplayName() const;
+    const std::string & GetStorageClass() const;
+    
+    // Copy out into the text form used when parsing
+    AWS_S3_Object Materialize() const;
+};
+
+// Compact storage for the objects of a bucket listing, built to hold millions
+// of keys. Keys are packed end to end in a single arena, owner IDs, display
+// names and storage classes are interned, and size, modification time and ETag
+// are kept in binary form in a fixed size record per object, so there is no
+// allocation per object.
+// 
+// S3 lists keys in order, and as long as they are added in order the catalog
+// stays sorted and Find() is a binary search.
+class AWS_S3_Catalog {
+  public:
+    struct Entry {
+        size_t key;// offset of NUL terminated key in keys
+        uint64_t size;
+        int64_t lastModified;// milliseconds since the epoch
+        uint32_t keyLength;
+        uint32_t ownerID;// strings
+        uint32_t ownerDisplayName;
+        uint32_t storageClass;
+        uint16_t eTagParts;// N for multipart ETags, "md5-N", kETagText if not in md5 form
+        uint8_t eTag[16];// MD5, or the index of the text in strings if eTagParts is kETagText
+    };
+    static const uint16_t kETagText = 0xFFFF;
+    static const size_t npos = (size_t)-1;
+    
+  private:
+    friend class AWS_S3_ObjectRef;
+    
+    std::vector<Entry> entries;
+    std::vector<char> keys;
+    std::vector<std::string> strings;
+    std::map<std::string, uint32_t> stringIDs;
+    bool sorted;
+    
+    uint32_t Intern(const std::string & str);
+    uint32_t Intern(const std::string & str, uint32_t previous);
+    bool Less(const Entry & a, const Entry & b) const;
+    struct KeyOrder;
+    
+  public:
+    AWS_S3_Catalog() {clear();}
+    
+    void Add(const AWS_S3_Object & obj);
+    // Add all objects of other after those already present
+    void Append(const AWS_S3_Catalog & other);
+    void clear();
+    
+    size_t size() const {return entries.size();}
+    bool empty() const {return entries.empty();}
+    AWS_S3_ObjectRef operator[](size_t idx) const {return AWS_S3_ObjectRef(this, idx);}
+    
+    // Index of the object with key, or npos if not present
+    size_t Find(const std::string & key) const;
+    
+    // Put keys in order, only needed if they were not added in order
+    bool Sorted() const {return sorted;}
+    void Sort();
+    
+    // Bytes used, for comparison with other representations
+    size_t MemoryUsed() const;
+    
+    class const_iterator {
+        AWS_S3_ObjectRef ref;
+        const AWS_S3_Catalog * catalog;
+        size_t idx;
+      public:
+        const_iterator(): ref(NULL, 0), catalog(NULL), idx(0) {}
+        const_iterator(const AWS_S3_Catalog * c, size_t i): ref(c, i), catalog(c), idx(i) {}
+        const AWS_S3_ObjectRef & operator*() const {return ref;}
+        const AWS_S3_ObjectRef * operator->() const {return &ref;}
+        const_iterator & operator++() {ref = AWS_S3_ObjectRef(catalog, ++idx); return *this;}
+        bool operator==(const const_iterator & rhs) const {return idx == rhs.idx;}
+        bool operator!=(const const_iterator & rhs) const {return idx != rhs.idx;}
+    };
+    
+    const_iterator begin() const {return const_iterator(this, 0);}
+    const_iterator end() const {return const_iterator(this, entries.size());}
+};
+
+//******************************************************************************
+#endif // AWS_S3_CATALOG_H
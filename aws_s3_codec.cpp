@@ -0,0 +1,325 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <cstring>
+
+#include "aws_s3_codec.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+static const char * kB64Chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char * kHexChars = "0123456789abcdef";
+
+// Values of base 64 and hex digits, -1 for anything else
+static const int8_t kB64Values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const int8_t kHexValues[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+//******************************************************************************
+// Base 64
+
+#if defined(__SSSE3__)
+// Encode 12 bytes as 16 characters. 16 bytes are read.
+static inline __m128i EncodeB64Block(__m128i in)
+{
+    // Spread each 3 bytes over a 32 bit lane, and shift the four 6 bit fields
+    // into separate bytes.
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t0, t1);
+    
+    // Map each range of indices to the offset of its characters: 0-25 'A',
+    // 26-51 'a', 52-61 '0', then '+' and '/'.
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                                              _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+// Decode 16 characters to 12 bytes, held in the low bytes of out. Returns false
+// if any character is not a base 64 digit, padding included.
+static inline bool DecodeB64Block(__m128i & out, __m128i in)
+{
+    // Classify by high and low nibble: a character is valid if no bit is
+    // set in both lookups.
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    __m128i lo = _mm_and_si128(in, nibble);
+    const __m128i loClass = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i hiClass = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    __m128i bad = _mm_and_si128(_mm_shuffle_epi8(loClass, lo), _mm_shuffle_epi8(hiClass, hi));
+    if(_mm_movemask_epi8(_mm_cmpgt_epi8(bad, _mm_setzero_si128())) != 0)
+        return false;
+    
+    // The high nibble picks the offset back to a 6 bit value, '/' aside.
+    const __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i values = _mm_add_epi8(in, _mm_shuffle_epi8(offsets, _mm_add_epi8(slash, hi)));
+    
+    // Pack pairs of 6 bit values to 12 bits, then pairs of those to 24, and
+    // gather the 3 bytes of each lane in order.
+    __m128i packed = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    packed = _mm_madd_epi16(packed, _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                                 -1, -1, -1, -1));
+    return true;
+}
+#endif
+
+// Encode binary data in ASCII form using base 64, writing B64EncodedLength(length)
+// characters to out. No terminator is written.
+size_t EncodeB64(char * out, const uint8_t * data, size_t length)
+{
+    char * o = out;
+    size_t j = 0;
+#if defined(__SSSE3__)
+    for(; length - j >= 16; j += 12, o += 16)
+        _mm_storeu_si128((__m128i *)o, EncodeB64Block(_mm_loadu_si128((const __m128i *)(data + j))));
+#endif
+    for(; length - j >= 3; j += 3, o += 4) {
+        uint32_t v = (data[j] << 16) | (data[j+1] << 8) | data[j+2];
+        o[0] = kB64Chars[v >> 18];
+        o[1] = kB64Chars[(v >> 12) & 0x3F];
+        o[2] = kB64Chars[(v >> 6) & 0x3F];
+        o[3] = kB64Chars[v & 0x3F];
+    }
+    if(j < length) {
+        uint32_t v = data[j] << 16;
+        if(j + 1 < length)
+            v |= data[j+1] << 8;
+        o[0] = kB64Chars[v >> 18];
+        o[1] = kB64Chars[(v >> 12) & 0x3F];
+        o[2] = (j + 1 < length)? kB64Chars[(v >> 6) & 0x3F] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+    return o - out;
+}
+
+// Decode base 64 text to out, which must have room for B64DecodedLength(length)
+// bytes. The text must be padded to a multiple of 4 characters, with no line
+// breaks or other whitespace. Returns the number of bytes decoded, or
+// kInvalidEncoding.
+size_t DecodeB64(uint8_t * out, const char * b64, size_t length)
+{
+    if(length%4 != 0)
+        return kInvalidEncoding;
+    if(length == 0)
+        return 0;
+    
+    uint8_t * o = out;
+    const uint8_t * in = (const uint8_t *)b64;
+    // The last group may hold padding, so is left for after the loop
+    size_t end = length - 4, j = 0;
+#if defined(__SSSE3__)
+    for(; end - j >= 16; j += 16, o += 12) {
+        __m128i block;
+        if(!DecodeB64Block(block, _mm_loadu_si128((const __m128i *)(in + j))))
+            break;// let the scalar loop find the bad character
+        uint8_t bytes[16];
+        _mm_storeu_si128((__m128i *)bytes, block);
+        memcpy(o, bytes, 12);
+    }
+#endif
+    for(; j < end; j += 4, o += 3) {
+        int a = kB64Values[in[j]], b = kB64Values[in[j+1]];
+        int c = kB64Values[in[j+2]], d = kB64Values[in[j+3]];
+        if((a | b | c | d) < 0)
+            return kInvalidEncoding;
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        o[0] = v >> 16;
+        o[1] = v >> 8;
+        o[2] = v;
+    }
+    
+    int a = kB64Values[in[j]], b = kB64Values[in[j+1]];
+    int c = kB64Values[in[j+2]], d = kB64Values[in[j+3]];
+    if((a | b) < 0)
+        return kInvalidEncoding;
+    uint32_t v = (a << 18) | (b << 12);
+    *o++ = v >> 16;
+    if(in[j+2] == '=')
+        return (in[j+3] == '=')? o - out : kInvalidEncoding;
+    if(c < 0)
+        return kInvalidEncoding;
+    v |= c << 6;
+    *o++ = v >> 8;
+    if(in[j+3] == '=')
+        return o - out;
+    if(d < 0)
+        return kInvalidEncoding;
+    *o++ = v | d;
+    return o - out;
+}
+
+std::string EncodeB64(const uint8_t * data, size_t length)
+{
+    string b64(B64EncodedLength(length), '\0');
+    if(length > 0)
+        EncodeB64(&b64[0], data, length);
+    return b64;
+}
+
+//******************************************************************************
+// Hex
+
+// Encode binary data as lower case hex, writing 2*length characters to out. No
+// terminator is written.
+size_t EncodeHex(char * out, const uint8_t * data, size_t length)
+{
+    size_t j = 0;
+#if defined(__SSE2__)
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    for(; length - j >= 16; j += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(data + j));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibble);
+        __m128i lo = _mm_and_si128(in, nibble);
+        __m128i d0 = _mm_unpacklo_epi8(hi, lo), d1 = _mm_unpackhi_epi8(hi, lo);
+        // '0' + d, and 'a' - 10 + d for d > 9
+        const __m128i nine = _mm_set1_epi8(9), zero = _mm_set1_epi8('0');
+        const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+        d0 = _mm_add_epi8(_mm_add_epi8(d0, zero), _mm_and_si128(_mm_cmpgt_epi8(d0, nine), alpha));
+        d1 = _mm_add_epi8(_mm_add_epi8(d1, zero), _mm_and_si128(_mm_cmpgt_epi8(d1, nine), alpha));
+        _mm_storeu_si128((__m128i *)(out + 2*j), d0);
+        _mm_storeu_si128((__m128i *)(out + 2*j + 16), d1);
+    }
+#endif
+    for(; j < length; ++j) {
+        out[2*j] = kHexChars[data[j] >> 4];
+        out[2*j + 1] = kHexChars[data[j] & 0x0F];
+    }
+    return 2*length;
+}
+
+#if defined(__SSE2__)
+// Values of 16 hex digits. Returns false if any character is not one.
+static inline bool HexDigits(__m128i & values, __m128i in)
+{
+    __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+        return false;
+    values = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+                          _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return true;
+}
+
+// Combine the digit pairs of each 16 bit lane into the lane's low byte
+static inline __m128i HexPairs(__m128i values)
+{
+    return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0x00F0)),
+                        _mm_srli_epi16(values, 8));
+}
+#endif
+
+// Decode hex digits of either case to out, which must have room for length/2
+// bytes. Returns the number of bytes decoded, or kInvalidEncoding if length is
+// odd or a character is not a hex digit.
+size_t DecodeHex(uint8_t * out, const char * hex, size_t length)
+{
+    if(length%2 != 0)
+        return kInvalidEncoding;
+    
+    const uint8_t * in = (const uint8_t *)hex;
+    size_t j = 0;
+#if defined(__SSE2__)
+    for(; length - j >= 32; j += 32) {
+        __m128i v0, v1;
+        if(!HexDigits(v0, _mm_loadu_si128((const __m128i *)(in + j))) ||
+           !HexDigits(v1, _mm_loadu_si128((const __m128i *)(in + j + 16))))
+            break;// let the scalar loop find the bad character
+        _mm_storeu_si128((__m128i *)(out + j/2), _mm_packus_epi16(HexPairs(v0), HexPairs(v1)));
+    }
+#endif
+    for(; j < length; j += 2) {
+        int hi = kHexValues[in[j]], lo = kHexValues[in[j+1]];
+        if((hi | lo) < 0)
+            return kInvalidEncoding;
+        out[j/2] = (hi << 4) | lo;
+    }
+    return length/2;
+}
+
+std::string EncodeHex(const uint8_t * data, size_t length)
+{
+    string hex(2*length, '\0');
+    if(length > 0)
+        EncodeHex(&hex[0], data, length);
+    return hex;
+}
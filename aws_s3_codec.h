@@ -0,0 +1,57 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_CODEC_H
+#define AWS_S3_CODEC_H
+
+#include <string>
+#include <stdint.h>
+#include <cstddef>
+
+// Base 64 (RFC 4648, padded, no line breaks) and hex codecs. These write into
+// caller provided buffers and return the number of bytes written, so fixed size
+// values such as a Content-MD5 or ETag need no allocation. Hex is encoded in
+// lower case, and either case is decoded.
+//******************************************************************************
+
+// Returned by the decoders for malformed input
+const size_t kInvalidEncoding = (size_t)-1;
+
+inline size_t B64EncodedLength(size_t length) {return (length + 2)/3*4;}
+// At most this many bytes are decoded, fewer if the input is padded
+inline size_t B64DecodedLength(size_t length) {return length/4*3;}
+
+size_t EncodeB64(char * out, const uint8_t * data, size_t length);
+size_t DecodeB64(uint8_t * out, const char * b64, size_t length);
+
+size_t EncodeHex(char * out, const uint8_t * data, size_t length);
+size_t DecodeHex(uint8_t * out, const char * hex, size_t length);
+
+std::string EncodeB64(const uint8_t * data, size_t length);
+std::string EncodeHex(const uint8_t * data, size_t length);
+
+#endif // AWS_S3_CODEC_H
@@ -0,0 +1,135 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <algorithm>
+#include <strings.h>
+
+#include "aws_s3_headers.h"
+
+using namespace std;
+
+bool HeaderView::Is(const char * name, size_t nameLength) const
+{
+    return length == nameLength && strncasecmp(data, name, length) == 0;
+}
+
+// Make room for length more bytes of text. Names and values being added may be
+// views of this same text, so a and b are moved along with it.
+void AWS_Headers::Reserve(size_t length, const char *& a, const char *& b)
+{
+    if(text.size() + length <= text.capacity())
+        return;
+    const char * old = text.empty()? NULL : &text[0];
+    const char * oldEnd = old + text.size();
+    // Room for the few headers of a typical request or response at first
+    text.reserve(max(max(text.size() + length, 2*text.capacity()), (size_t)512));
+    if(old != NULL) {
+        if(a >= old && a < oldEnd)
+            a = &text[0] + (a - old);
+        if(b >= old && b < oldEnd)
+            b = &text[0] + (b - old);
+    }
+}
+
+// Copy data to the end of text, which must have room for it
+size_t AWS_Headers::Append(const char * data, size_t length)
+{
+    size_t offset = text.size();
+    text.resize(offset + length);
+    if(length > 0)
+        memmove(&text[offset], data, length);
+    return offset;
+}
+
+long AWS_Headers::Index(const char * name, size_t nameLength) const
+{
+    for(size_t j = 0; j < entries.size(); ++j)
+        if(entries[j].nameLength == nameLength && strncasecmp(At(entries[j].name), name, nameLength) == 0)
+            return j;
+    return -1;
+}
+
+bool AWS_Headers::Get(const char * name, HeaderView & value) const
+{
+    long j = Index(name, strlen(name));
+    if(j >= 0)
+        value = Value(j);
+    return j >= 0;
+}
+
+bool AWS_Headers::Get(const char * name, string & value) const
+{
+    long j = Index(name, strlen(name));
+    if(j >= 0)
+        value.assign(At(entries[j].value), entries[j].valueLength);
+    return j >= 0;
+}
+
+HeaderView AWS_Headers::Find(const char * name) const
+{
+    HeaderView value;
+    Get(name, value);
+    return value;
+}
+
+string AWS_Headers::GetWithDefault(const char * name, const string & defaultVal) const
+{
+    long j = Index(name, strlen(name));
+    return (j >= 0)? Value(j).Str() : defaultVal;
+}
+
+void AWS_Headers::Insert(const char * name, size_t nameLength, const char * value, size_t valueLength)
+{
+    Reserve(nameLength + valueLength, name, value);
+    Entry entry;
+    entry.name = Append(name, nameLength);
+    entry.nameLength = nameLength;
+    entry.value = Append(value, valueLength);
+    entry.valueLength = entry.valueSpace = valueLength;
+    if(entries.empty())
+        entries.reserve(16);
+    entries.push_back(entry);
+}
+
+void AWS_Headers::Set(const char * name, size_t nameLength, const char * value, size_t valueLength)
+{
+    long j = Index(name, nameLength);
+    if(j < 0) {
+        Insert(name, nameLength, value, valueLength);
+        return;
+    }
+    Entry & entry = entries[j];
+    if(valueLength > entry.valueSpace) {
+        Reserve(valueLength, name, value);
+        entry.value = Append(value, valueLength);
+        entry.valueSpace = valueLength;
+    }
+    else if(valueLength > 0) {
+        memmove(&text[0] + entry.value, value, valueLength);
+    }
+    entry.valueLength = valueLength;
+}
@@ -0,0 +1,118 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_HEADERS_H
+#define AWS_S3_HEADERS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+// A view of a header name or value held by an AWS_Headers, valid only until the
+// headers are next changed. No copy is made until Str().
+struct HeaderView {
+    const char * data;
+    size_t length;
+    
+    HeaderView(): data(""), length(0) {}
+    HeaderView(const char * d, size_t l): data(d), length(l) {}
+    
+    std::string Str() const {return std::string(data, length);}
+    
+    bool operator==(const char * str) const {return strlen(str) == length && memcmp(data, str, length) == 0;}
+    bool operator!=(const char * str) const {return !(*this == str);}
+    
+    // Compare ignoring case, as header names are
+    bool Is(const char * name, size_t nameLength) const;
+    bool Is(const char * name) const {return Is(name, strlen(name));}
+};
+
+inline std::ostream & operator<<(std::ostream & ostrm, const HeaderView & view) {
+    return ostrm.write(view.data, view.length);
+}
+
+// HTTP headers of a request or response, in the order they were added. Names are
+// matched ignoring case, and lookups return the first header of that name.
+// 
+// Names and values are copied back to back into one buffer, and the entries only
+// record where they are, so adding a header does not allocate once the buffer and
+// entry list have grown to fit a request. Clear() keeps both for the next one.
+// Replacing a value reuses its space if the new value fits.
+class AWS_Headers {
+    struct Entry {
+        size_t name, nameLength;// offsets into text
+        size_t value, valueLength, valueSpace;
+    };
+    std::vector<char> text;
+    std::vector<Entry> entries;
+    
+    const char * At(size_t offset) const {return text.empty()? "" : &text[0] + offset;}
+    void Reserve(size_t length, const char *& a, const char *& b);
+    size_t Append(const char * data, size_t length);
+    long Index(const char * name, size_t nameLength) const;// -1 if absent
+    
+  public:
+    AWS_Headers() {}
+    
+    void Clear() {text.clear(); entries.clear();}
+    
+    size_t Size() const {return entries.size();}
+    bool Empty() const {return entries.empty();}
+    
+    // The jth header
+    HeaderView Name(size_t j) const {return HeaderView(At(entries[j].name), entries[j].nameLength);}
+    HeaderView Value(size_t j) const {return HeaderView(At(entries[j].value), entries[j].valueLength);}
+    
+    bool Exists(const char * name) const {return Index(name, strlen(name)) >= 0;}
+    
+    // Get the value of the first header called name. Returns false, leaving
+    // value unchanged, if there is none.
+    bool Get(const char * name, HeaderView & value) const;
+    bool Get(const char * name, std::string & value) const;
+    
+    // The value of the first header called name, or an empty view
+    HeaderView Find(const char * name) const;
+    std::string GetWithDefault(const char * name, const std::string & defaultVal) const;
+    
+    // Add a header, regardless of any others with the same name
+    void Insert(const char * name, size_t nameLength, const char * value, size_t valueLength);
+    void Insert(const char * name, const char * value) {Insert(name, strlen(name), value, strlen(value));}
+    void Insert(const std::string & name, const std::string & value) {
+        Insert(name.data(), name.length(), value.data(), value.length());
+    }
+    
+    // Replace the value of the first header called name, or add one
+    void Set(const char * name, size_t nameLength, const char * value, size_t valueLength);
+    void Set(const char * name, const char * value) {Set(name, strlen(name), value, strlen(value));}
+    void Set(const char * name, const std::string & value) {Set(name, strlen(name), value.data(), value.length());}
+    void Set(const std::string & name, const std::string & value) {
+        Set(name.data(), name.length(), value.data(), value.length());
+    }
+};
+
+#endif // AWS_S3_HEADERS_H
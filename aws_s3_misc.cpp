@@ -32,43 +32,42 @@
 #include <string>
 #include <map>
 #include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-using namespace std;
 
-// Encode binary data in ASCII form using base 64
-std::string EncodeB64(uint8_t * data, size_t dataLen)
-{
-    // http://www.ioncannon.net/programming/34/howto-base64-encode-with-cc-and-openssl/
-    BIO * b64 = BIO_new(BIO_f_base64());
-    BIO * bmem = BIO_new(BIO_s_mem());
-    b64 = BIO_push(b64, bmem);
-    BIO_write(b64, data, dataLen);
-    BIO_ctrl(b64, BIO_CTRL_FLUSH, 0, NULL);//BIO_flush(b64);
-    
-    BUF_MEM * bptr;
-    BIO_get_mem_ptr(b64, &bptr);
-    
-    string b64string(bptr->data, bptr->length-1);
-//    cout << "b64string: \"" << b64string << "\"" << endl;
-    BIO_free_all(b64);
-	return b64string;
-}
+using namespace std;
 
 // Compute a MD5 checksum of a given data stream as a binary string
 // openssl dgst -md5 -binary FILE | openssl enc -base64
 const streamsize kMD5_ChunkSize = 16384;
-const char * hexchars = "0123456789abcdef";
 size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream & istrm)
+{
+    return ComputeMD5(md5, istrm, numeric_limits<size_t>::max());
+}
+
+// Compute a MD5 checksum of at most count bytes from a given data stream
+size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream & istrm, size_t count)
 {
     EVP_MD_CTX ctx;
     EVP_DigestInit(&ctx, EVP_md5());
     
     uint8_t * buf = new uint8_t[kMD5_ChunkSize];
-    while(istrm) {
-        istrm.read((char*)buf, kMD5_ChunkSize);
-        streamsize count = istrm.gcount();
-        EVP_DigestUpdate(&ctx, buf, count);
+    while(istrm && count > 0) {
+        istrm.read((char*)buf, (streamsize)min(count, (size_t)kMD5_ChunkSize));
+        streamsize n = istrm.gcount();
+        EVP_DigestUpdate(&ctx, buf, n);
+        count -= n;
     }
     delete[] buf;
     
@@ -78,16 +77,24 @@ size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream & istrm)
     return mdLen;
 }
 
+// Compute a MD5 checksum of count bytes held in memory
+size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], const char * data, size_t count)
+{
+    EVP_MD_CTX ctx;
+    EVP_DigestInit(&ctx, EVP_md5());
+    EVP_DigestUpdate(&ctx, data, count);
+    unsigned int mdLen;
+    EVP_DigestFinal_ex(&ctx, md5, &mdLen);
+    EVP_MD_CTX_cleanup(&ctx);
+    return mdLen;
+}
+
 // Compute a MD5 checksum of a given data stream as a hex-encoded ASCII string
 std::string ComputeMD5(std::istream & istrm)
 {
     uint8_t md5[EVP_MAX_MD_SIZE];
     size_t mdLen = ComputeMD5(md5, istrm);
-    std::ostringstream md5strm;
-    for(size_t j = 0; j < mdLen; ++j)
-        md5strm << hexchars[(md5[j] >> 4) & 0x0F] << hexchars[md5[j] & 0x0F];
-    
-    return md5strm.str();
+    return EncodeHex(md5, mdLen);
 }
 
 // Generate a signature from a message and secret.
@@ -104,22 +111,198 @@ string GenerateSignature(const string & secret, const string & stringToSign)
     return EncodeB64(md, mdLength);
 }
 
+// Find the first occurrence of the byte pair c0 c1 in [p, end)
+static const char * FindPair(const char * p, const char * end, char c0, char c1)
+{
+#if defined(__AVX2__)
+    const __m256i v0 = _mm256_set1_epi8(c0), v1 = _mm256_set1_epi8(c1);
+    while(end - p >= 33) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, v0),
+                                                              _mm256_cmpeq_epi8(b, v1)));
+        if(mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i v0 = _mm_set1_epi8(c0), v1 = _mm_set1_epi8(c1);
+    while(end - p >= 17) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, v0),
+                                                        _mm_cmpeq_epi8(b, v1)));
+        if(mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    // memchr() is itself vectorized on most platforms
+    while(end - p >= 2) {
+        p = (const char *)memchr(p, c0, end - p - 1);
+        if(p == NULL)
+            return NULL;
+        if(p[1] == c1)
+            return p;
+        ++p;
+    }
+    return NULL;
+}
+
+// Find <tag> or </tag> in [p, end), returning a pointer to the '<'
+static const char * FindTag(const char * p, const char * end, const char * tag, size_t tagLen,
+                            bool closing)
+{
+    size_t prefix = closing? 2 : 1;
+    while((p = FindPair(p, end, '<', closing? '/' : tag[0])) != NULL)
+    {
+        if((size_t)(end - p) < prefix + tagLen + 1)
+            return NULL;
+        if(memcmp(p + prefix, tag, tagLen) == 0 && p[prefix + tagLen] == '>')
+            return p;
+        ++p;
+    }
+    return NULL;
+}
+
+bool ScanXML(XMLView & data, size_t & crsr, const char * tag, size_t tagLen,
+             const char * xml, size_t xmlLen)
+{
+    data = XMLView();
+    const char * end = xml + xmlLen;
+    const char * open = (crsr < xmlLen && tagLen > 0)?
+                        FindTag(xml + crsr, end, tag, tagLen, false) : NULL;
+    if(open == NULL) {
+        crsr = xmlLen;
+        return false;
+    }
+    const char * start = open + tagLen + 2;
+    const char * close = FindTag(start, end, tag, tagLen, true);
+    if(close == NULL) {
+        crsr = xmlLen;
+        return false;
+    }
+    data = XMLView(start, close - start);
+    crsr = (close + tagLen + 3) - xml;
+    return true;
+}
+
 bool ExtractXML(string & data, string::size_type & crsr, const string & tag, const string & xml)
 {
-    string startTag = string("<") + tag + ">";
-    string endTag = string("</") + tag + ">";
-    crsr = xml.find(startTag, crsr);
-    if(crsr != string::npos) {
-        crsr += startTag.size();
-        string::size_type crsr2 = xml.find(endTag, crsr);
-        data = string(xml, crsr, crsr2 - crsr);
-        crsr = crsr2 + endTag.size();
+    XMLView view;
+    if(ScanXML(view, crsr, tag, xml)) {
+        data.assign(view.data, view.length);
         return true;
     }
+    crsr = string::npos;
     data = "";
     return false;
 }
 
+void XMLView::Decode(string & str) const
+{
+    const char * end = data + length;
+    const char * amp = (length == 0)? NULL : (const char *)memchr(data, '&', length);
+    if(amp == NULL) {
+        str.assign(data, length);
+        return;
+    }
+    
+    str.assign(data, amp - data);
+    while(amp != NULL)
+    {
+        const char * semi = (const char *)memchr(amp, ';', end - amp);
+        if(semi == NULL) {
+            str.append(amp, end - amp);
+            break;
+        }
+        const char * entity = amp + 1;
+        size_t entityLength = semi - entity;
+        if(entityLength == 3 && memcmp(entity, "amp", 3) == 0) str += '&';
+        else if(entityLength == 2 && memcmp(entity, "lt", 2) == 0) str += '<';
+        else if(entityLength == 2 && memcmp(entity, "gt", 2) == 0) str += '>';
+        else if(entityLength == 4 && memcmp(entity, "quot", 4) == 0) str += '"';
+        else if(entityLength == 4 && memcmp(entity, "apos", 4) == 0) str += '\'';
+        else if(entityLength > 1 && entity[0] == '#') {
+            unsigned long c = (entity[1] == 'x')? strtoul(entity + 2, NULL, 16) :
+                                                  strtoul(entity + 1, NULL, 10);
+            // UTF-8 encode
+            if(c < 0x80) {
+                str += (char)c;
+            }
+            else if(c < 0x800) {
+                str += (char)(0xC0 | (c >> 6));
+                str += (char)(0x80 | (c & 0x3F));
+            }
+            else if(c < 0x10000) {
+                str += (char)(0xE0 | (c >> 12));
+                str += (char)(0x80 | ((c >> 6) & 0x3F));
+                str += (char)(0x80 | (c & 0x3F));
+            }
+            else {
+                str += (char)(0xF0 | (c >> 18));
+                str += (char)(0x80 | ((c >> 12) & 0x3F));
+                str += (char)(0x80 | ((c >> 6) & 0x3F));
+                str += (char)(0x80 | (c & 0x3F));
+            }
+        }
+        else {
+            // Not an entity we know, keep as is
+            str.append(amp, semi + 1 - amp);
+        }
+        // Copy through to the next entity
+        const char * next = semi + 1;
+        amp = (const char *)memchr(next, '&', end - next);
+        str.append(next, ((amp == NULL)? end : amp) - next);
+    }
+}
+
+bool XMLView::operator==(const char * str) const
+{
+    return strlen(str) == length && memcmp(data, str, length) == 0;
+}
+
+string DecodeXML(const string & text)
+{
+    string result;
+    XMLView(text.data(), text.length()).Decode(result);
+    return result;
+}
+
+string EncodeXML(const string & text)
+{
+    string result;
+    result.reserve(text.length());
+    for(size_t j = 0; j < text.length(); ++j) {
+        switch(text[j]) {
+            case '&': result += "&amp;"; break;
+            case '<': result += "&lt;"; break;
+            case '>': result += "&gt;"; break;
+            case '"': result += "&quot;"; break;
+            case '\'': result += "&apos;"; break;
+            default: result += text[j]; break;
+        }
+    }
+    return result;
+}
+
+string URLEncode(const string & str)
+{
+    string result;
+    for(size_t j = 0; j < str.length(); ++j) {
+        unsigned char c = str[j];
+        if(isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            result += c;
+        }
+        else {
+            result += '%';
+            result += "0123456789ABCDEF"[c >> 4];
+            result += "0123456789ABCDEF"[c & 0x0F];
+        }
+    }
+    return result;
+}
+
 // Generates a string with the current time formatted in the way required by the HTTP protocol.
 string HTTP_Date()
 {
@@ -156,4 +339,28 @@ string HumanSize(size_t size)
     return strm.str();
 }
 
+bool ParseSize(size_t & size, const string & str)
+{
+    const char * s = str.c_str();
+    if(!isdigit((unsigned char)*s))
+        return false;
+    
+    char * end = NULL;
+    errno = 0;
+    unsigned long n = strtoul(s, &end, 10);
+    if(errno == ERANGE)
+        return false;
+    
+    int shift = 0;
+    switch(*end) {
+        case 'G': case 'g': shift = 30; ++end; break;
+        case 'M': case 'm': shift = 20; ++end; break;
+        case 'K': case 'k': shift = 10; ++end; break;
+    }
+    if(*end != '\0' || n == 0 || n > (numeric_limits<size_t>::max() >> shift))
+        return false;
+    size = (size_t)n << shift;
+    return true;
+}
+
 //******************************************************************************
@@ -31,24 +31,53 @@
 #include <iostream>
 #include <string>
 #include <openssl/md5.h>
-#include <openssl/buffer.h>
 #include <openssl/hmac.h>
-#include <openssl/bio.h>
 
-//******************************************************************************
+#include "aws_s3_codec.h"
 
-std::string EncodeB64(uint8_t * data, size_t dataLen);
+//******************************************************************************
 
 size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream & istrm);
+size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream & istrm, size_t count);
+size_t ComputeMD5(uint8_t md5[EVP_MAX_MD_SIZE], const char * data, size_t count);
 std::string ComputeMD5(std::istream & istrm);
 
 std::string GenerateSignature(const std::string & secret, const std::string & stringToSign);
 
-// A very minimal XML parser. 
-// Extract text enclosed between <tag> and </tag>, starting from crsr
-// position and leaving crsr at the character index following the end tag.
-// Does not handle nested <tag>...</tag> constructs, any nested tags must
-// be of a different type.
+// A view of a range of characters in a response, valid only as long as the
+// response itself is unchanged. No copy is made until Str() or Decoded().
+struct XMLView {
+    const char * data;
+    size_t length;
+    
+    XMLView(): data(NULL), length(0) {}
+    XMLView(const char * d, size_t l): data(d), length(l) {}
+    
+    std::string Str() const {return std::string(data, length);}
+    // Text with entities such as &quot; replaced
+    std::string Decoded() const {std::string str; Decode(str); return str;}
+    void Decode(std::string & str) const;
+    
+    bool operator==(const char * str) const;
+    bool operator!=(const char * str) const {return !(*this == str);}
+};
+
+// A very minimal XML scanner. 
+// Find text enclosed between <tag> and </tag> in xml, starting from crsr position
+// and leaving crsr at the character index following the end tag. Does not handle
+// nested <tag>...</tag> constructs, any nested tags must be of a different type.
+// Returns false, leaving crsr at xmlLen, if there is no complete element.
+// Tags are located with a vectorized search for '<' followed by the first
+// character of the tag, using SSE2 or AVX2 when compiled for them.
+bool ScanXML(XMLView & data, size_t & crsr, const char * tag, size_t tagLen,
+             const char * xml, size_t xmlLen);
+
+inline bool ScanXML(XMLView & data, std::string::size_type & crsr,
+                    const std::string & tag, const std::string & xml) {
+    return ScanXML(data, crsr, tag.data(), tag.length(), xml.data(), xml.length());
+}
+
+// As ScanXML(), but copying the text, which is left undecoded.
 bool ExtractXML(std::string & data, std::string::size_type & crsr,
                 const std::string & tag, const std::string & xml);
 
@@ -60,10 +89,25 @@ inline bool ExtractXML(std::string & data, const std::string & tag, const std::s
     return ExtractXML(data, crsr, tag, xml);
 }
 
+// Replace the predefined XML entities (&amp;, &lt;, &gt;, &quot;, &apos;) and
+// numeric character references in text extracted from a response.
+std::string DecodeXML(const std::string & text);
+
+// Replace characters that can not appear as is in XML text with entities, for
+// keys and other values placed in request bodies.
+std::string EncodeXML(const std::string & text);
+
+// Percent-encode everything but unreserved characters, for query parameters.
+std::string URLEncode(const std::string & str);
+
 std::string HTTP_Date();
 
 
 std::string HumanSize(size_t size);
 
+// Parse a size with an optional K, M or G (binary) suffix: "16M". Returns false,
+// leaving size unchanged, for anything else, including a size of zero.
+bool ParseSize(size_t & size, const std::string & str);
+
 //******************************************************************************
 #endif // AWS_S3_MISC_H
@@ -0,0 +1,231 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <algorithm>
+
+#include <poll.h>
+
+#include "aws_s3_pool.h"
+
+using namespace std;
+
+static CURLSH * share = NULL;
+static pthread_once_t shareOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+
+static pthread_mutex_t countLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t requestCount = 0, connectCount = 0;
+
+static void LockShare(CURL *, curl_lock_data data, curl_lock_access, void *)
+{
+    pthread_mutex_lock(&shareLocks[data]);
+}
+
+static void UnlockShare(CURL *, curl_lock_data data, void *)
+{
+    pthread_mutex_unlock(&shareLocks[data]);
+}
+
+static void InitShare()
+{
+    for(int j = 0; j < CURL_LOCK_DATA_LAST; ++j)
+        pthread_mutex_init(&shareLocks[j], NULL);
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, LockShare);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, UnlockShare);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // Sharing the connection cache needs libcurl 7.57.0
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+// An idle connection has nothing to read. If it is readable, the server has
+// closed it, or sent something no request is waiting for.
+static bool ConnectionAlive(AWS_Connection * conn)
+{
+#if LIBCURL_VERSION_NUM >= 0x072D00
+    curl_socket_t sock = CURL_SOCKET_BAD;
+    if(curl_easy_getinfo(conn->getHandle(), CURLINFO_ACTIVESOCKET, &sock) != CURLE_OK ||
+       sock == CURL_SOCKET_BAD)
+        return false;
+#else
+    // CURLINFO_ACTIVESOCKET needs libcurl 7.45.0
+    long sock = -1;
+    if(curl_easy_getinfo(conn->getHandle(), CURLINFO_LASTSOCKET, &sock) != CURLE_OK || sock == -1)
+        return false;
+#endif
+    
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// Length of the scheme and host at the start of url, "http://bucket.s3.amazonaws.com"
+static size_t HostLength(const string & url)
+{
+    size_t start = url.find("://");
+    start = (start == string::npos)? 0 : start + 3;
+    return min(url.find('/', start), url.length());
+}
+
+AWS_ConnectionPool::AWS_ConnectionPool(size_t n, int t):
+    maxIdle(n),
+    maxIdleTime(t)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+AWS_ConnectionPool::~AWS_ConnectionPool()
+{
+    Clear();
+    pthread_mutex_destroy(&mutex);
+}
+
+// Entries leaving the idle list keep their nodes and host strings in spare, so
+// that checking out and returning handles does not allocate.
+void AWS_ConnectionPool::Discard(list<Entry>::iterator e)
+{
+    delete e->conn;
+    e->conn = NULL;
+    spare.splice(spare.end(), idle, e);
+}
+
+void AWS_ConnectionPool::Trim()
+{
+    while(idle.size() > maxIdle)
+        Discard(idle.begin());
+}
+
+void AWS_ConnectionPool::SetMaxIdle(size_t n)
+{
+    pthread_mutex_lock(&mutex);
+    maxIdle = n;
+    Trim();
+    pthread_mutex_unlock(&mutex);
+}
+
+void AWS_ConnectionPool::SetMaxIdleTime(int seconds)
+{
+    pthread_mutex_lock(&mutex);
+    maxIdleTime = seconds;
+    pthread_mutex_unlock(&mutex);
+}
+
+AWS_Connection * AWS_ConnectionPool::Checkout(const string & url)
+{
+    AWS_Connection * conn = NULL;
+    size_t hostLength = HostLength(url);
+    time_t now = time(NULL);
+    
+    pthread_mutex_lock(&mutex);
+    // Servers close connections that have been idle for a while
+    while(!idle.empty() && now - idle.front().lastUsed > maxIdleTime)
+        Discard(idle.begin());
+    
+    // The most recently used connection is the most likely to still be open
+    list<Entry>::iterator e = idle.end();
+    while(conn == NULL && e != idle.begin()) {
+        --e;
+        if(e->host.length() != hostLength || url.compare(0, hostLength, e->host) != 0)
+            continue;
+        list<Entry>::iterator next = e;
+        ++next;
+        if(ConnectionAlive(e->conn)) {
+            conn = e->conn;
+            e->conn = NULL;
+            spare.splice(spare.end(), idle, e);
+        }
+        else {
+            Discard(e);
+        }
+        e = next;
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    // A reused handle keeps its options, AWS::Prepare() sets those that change
+    if(conn == NULL)
+        conn = new AWS_Connection;
+    return conn;
+}
+
+void AWS_ConnectionPool::Return(const string & url, AWS_Connection * conn)
+{
+    pthread_mutex_lock(&mutex);
+    if(spare.empty())
+        spare.push_back(Entry());
+    list<Entry>::iterator e = spare.begin();
+    e->host.assign(url, 0, HostLength(url));
+    e->conn = conn;
+    e->lastUsed = time(NULL);
+    idle.splice(idle.end(), spare, e);
+    Trim();
+    pthread_mutex_unlock(&mutex);
+}
+
+void AWS_ConnectionPool::Clear()
+{
+    pthread_mutex_lock(&mutex);
+    while(!idle.empty())
+        Discard(idle.begin());
+    pthread_mutex_unlock(&mutex);
+}
+
+size_t AWS_ConnectionPool::Idle()
+{
+    pthread_mutex_lock(&mutex);
+    size_t n = idle.size();
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+CURLSH * AWS_ConnectionPool::Share()
+{
+    pthread_once(&shareOnce, InitShare);
+    return share;
+}
+
+void AWS_ConnectionPool::Count(CURL * handle)
+{
+    long connects = 0;
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    pthread_mutex_lock(&countLock);
+    ++requestCount;
+    connectCount += connects;
+    pthread_mutex_unlock(&countLock);
+}
+
+void AWS_ConnectionPool::GetCounts(size_t & requests, size_t & connects)
+{
+    pthread_mutex_lock(&countLock);
+    requests = requestCount;
+    connects = connectCount;
+    pthread_mutex_unlock(&countLock);
+}
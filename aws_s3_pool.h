@@ -0,0 +1,106 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_POOL_H
+#define AWS_S3_POOL_H
+
+#include <ctime>
+#include <list>
+#include <string>
+
+#include <pthread.h>
+#include <curl/curl.h>
+#include "aws_s3.h"
+
+// Idle connections kept open for reuse by later requests to the same host, so
+// they do not each pay for a new TCP connection. AWS::Send() checks a handle out
+// for every request that is not given one by the caller, and returns it when the
+// request is done. Checkout and return may be called from several threads.
+// 
+// At most maxIdle handles are kept, the least recently used are closed first.
+// Handles idle for more than maxIdleTime seconds, or whose connection has been
+// closed by the server, are discarded rather than reused.
+// 
+// Requests queued on an AWS_Transfer bring their own handles and do not use the
+// pool. All handles, pooled or not, are attached by AWS::Prepare() to one libcurl
+// share handle for the process, which holds the DNS cache, TLS sessions and open
+// connections. A new handle can then resume a TLS session or reuse a connection
+// opened by another.
+class AWS_ConnectionPool {
+    struct Entry {
+        std::string host;
+        AWS_Connection * conn;
+        time_t lastUsed;
+        Entry(): conn(NULL), lastUsed(0) {}
+    };
+    
+    std::list<Entry> idle;// oldest first
+    std::list<Entry> spare;// unused entries, kept to avoid allocating
+    size_t maxIdle;
+    int maxIdleTime;
+    pthread_mutex_t mutex;
+    
+    void Discard(std::list<Entry>::iterator e);
+    void Trim();
+    
+    // Not copyable
+    AWS_ConnectionPool(const AWS_ConnectionPool &);
+    AWS_ConnectionPool & operator=(const AWS_ConnectionPool &);
+    
+  public:
+    AWS_ConnectionPool(size_t maxIdle = 8, int maxIdleTime = 15);
+    ~AWS_ConnectionPool();
+    
+    void SetMaxIdle(size_t n);
+    void SetMaxIdleTime(int seconds);
+    
+    // Get a handle for a request to url, an idle one connected to the same scheme
+    // and host ("http://bucket.s3.amazonaws.com") if available, otherwise a new
+    // one. The caller owns the handle until it is returned. Reused handles keep
+    // the options of their last request.
+    AWS_Connection * Checkout(const std::string & url);
+    
+    // Make a handle available for reuse by requests to url's scheme and host.
+    // Handles that failed with a transport error, or whose connection the server
+    // is closing, should be deleted instead.
+    void Return(const std::string & url, AWS_Connection * conn);
+    
+    // Close all idle connections
+    void Clear();
+    
+    size_t Idle();
+    
+    // The process-wide share handle, created on first use
+    static CURLSH * Share();
+    
+    // Record a completed request on handle, and the new connections it needed.
+    // With HTTPS, each new connection is a TLS handshake.
+    static void Count(CURL * handle);
+    static void GetCounts(size_t & requests, size_t & connects);
+};
+
+#endif // AWS_S3_POOL_H
@@ -0,0 +1,472 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <algorithm>
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "aws_s3_sign.h"
+#include "aws_s3_codec.h"
+
+using namespace std;
+
+const char * AWS_SigV4::kEmptyPayload = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+const char * AWS_SigV4::kUnsignedPayload = "UNSIGNED-PAYLOAD";
+const char * AWS_SigV4::kStreamingPayload = "STREAMING-AWS4-HMAC-SHA256-PAYLOAD";
+
+static const char * kChunkSignature = ";chunk-signature=";
+static const size_t kChunkSignatureLen = 17;
+
+static int HexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Append str to out with everything but unreserved characters percent-encoded,
+// and '/' too unless in a path. Escapes already in str are decoded first, so
+// they are not encoded twice.
+static void AppendURIEncoded(string & out, const char * str, size_t length, bool path)
+{
+    static const char * digits = "0123456789ABCDEF";
+    for(size_t j = 0; j < length; ++j) {
+        unsigned char c = str[j];
+        bool escaped = false;
+        if(c == '%' && j + 2 < length && HexValue(str[j+1]) >= 0 && HexValue(str[j+2]) >= 0) {
+            c = HexValue(str[j+1])*16 + HexValue(str[j+2]);
+            j += 2;
+            escaped = true;
+        }
+        if((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+           c == '-' || c == '_' || c == '.' || c == '~' || (c == '/' && path && !escaped))
+        {
+            out += (char)c;
+        }
+        else {
+            out += '%';
+            out += digits[c >> 4];
+            out += digits[c & 0x0F];
+        }
+    }
+}
+
+// Reuse the entry at idx of a vector of pairs, growing it if needed
+static pair<string, string> & Entry(vector<pair<string, string> > & entries, size_t idx)
+{
+    if(idx == entries.size())
+        entries.push_back(pair<string, string>());
+    entries[idx].first.clear();
+    entries[idx].second.clear();
+    return entries[idx];
+}
+
+// Sort the first n entries. Lists are short, and an insertion sort swapping the
+// strings keeps their buffers, where std::sort would copy them.
+static void SortEntries(vector<pair<string, string> > & entries, size_t n)
+{
+    for(size_t j = 1; j < n; ++j) {
+        for(size_t k = j; k > 0 && entries[k] < entries[k-1]; --k) {
+            entries[k].first.swap(entries[k-1].first);
+            entries[k].second.swap(entries[k-1].second);
+        }
+    }
+}
+
+//******************************************************************************
+
+AWS_SigV4::AWS_SigV4(const string & kid, const string & sk, const string & r, const string & s):
+    keyID(kid), secret(sk), region(r), service(s)
+{
+    pthread_mutex_init(&mutex, NULL);
+    keyDate[0] = '\0';
+}
+
+AWS_SigV4::~AWS_SigV4()
+{
+    pthread_mutex_destroy(&mutex);
+}
+
+void AWS_SigV4::SetRegion(const string & r)
+{
+    pthread_mutex_lock(&mutex);
+    region = r;
+    keyDate[0] = '\0';// derive again
+    pthread_mutex_unlock(&mutex);
+}
+
+void AWS_SigV4::AmzDate(char date[17], time_t t)
+{
+    tm gmt;
+    gmtime_r(&t, &gmt);
+    strftime(date, 17, "%Y%m%dT%H%M%SZ", &gmt);
+}
+
+bool AWS_SigV4::HashPayload(istream & istrm, size_t length, char hash[65])
+{
+    streampos start = istrm.tellg();
+    if(start == streampos(-1))
+        return false;
+    
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    char buf[16384];
+    while(length > 0 && istrm) {
+        istrm.read(buf, min(length, sizeof(buf)));
+        SHA256_Update(&ctx, buf, istrm.gcount());
+        length -= istrm.gcount();
+    }
+    uint8_t md[SHA256_DIGEST_LENGTH];
+    SHA256_Final(md, &ctx);
+    EncodeHex(hash, md, sizeof(md));
+    hash[64] = '\0';
+    
+    istrm.clear();
+    istrm.seekg(start);
+    return true;
+}
+
+void AWS_SigV4::DeriveKey(const char * date)
+{
+    string kSecret = "AWS4" + secret;
+    uint8_t key[SHA256_DIGEST_LENGTH];
+    unsigned int keyLen = 0;
+    ::HMAC(EVP_sha256(), kSecret.data(), kSecret.length(), (const uint8_t *)date, 8, key, &keyLen);
+    ::HMAC(EVP_sha256(), key, keyLen, (const uint8_t *)region.data(), region.length(), key, &keyLen);
+    ::HMAC(EVP_sha256(), key, keyLen, (const uint8_t *)service.data(), service.length(), key, &keyLen);
+    ::HMAC(EVP_sha256(), key, keyLen, (const uint8_t *)"aws4_request", 12, key, &keyLen);
+    
+    // HMAC(key, m) = H((key ^ opad) + H((key ^ ipad) + m)), and the padded keys
+    // fill exactly one block, so their hash states can be kept and copied.
+    uint8_t pad[SHA256_CBLOCK];
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, key, keyLen);
+    for(size_t j = 0; j < sizeof(pad); ++j)
+        pad[j] ^= 0x36;
+    SHA256_Init(&inner);
+    SHA256_Update(&inner, pad, sizeof(pad));
+    for(size_t j = 0; j < sizeof(pad); ++j)
+        pad[j] ^= 0x36 ^ 0x5C;
+    SHA256_Init(&outer);
+    SHA256_Update(&outer, pad, sizeof(pad));
+    
+    memcpy(keyDate, date, 8);
+    keyDate[8] = '\0';
+    scope.assign(date, 8);
+    scope += '/';
+    scope += region;
+    scope += '/';
+    scope += service;
+    scope += "/aws4_request";
+}
+
+void AWS_SigV4::HMAC(const char * data, size_t length, uint8_t md[SHA256_DIGEST_LENGTH]) const
+{
+    uint8_t innerHash[SHA256_DIGEST_LENGTH];
+    SHA256_CTX ctx = inner;
+    SHA256_Update(&ctx, data, length);
+    SHA256_Final(innerHash, &ctx);
+    ctx = outer;
+    SHA256_Update(&ctx, innerHash, sizeof(innerHash));
+    SHA256_Final(md, &ctx);
+}
+
+void AWS_SigV4::Sign(const string & method, const string & url, const AWS_Headers & sendHeaders,
+                     string & authorization, char signature[65])
+{
+    // scheme://host[:port]/path?query
+    string::size_type hostStart = url.find("://");
+    hostStart = (hostStart == string::npos)? 0 : hostStart + 3;
+    string::size_type pathStart = url.find_first_of("/?", hostStart);
+    if(pathStart == string::npos)
+        pathStart = url.length();
+    string::size_type queryStart = url.find('?', pathStart);
+    if(queryStart == string::npos)
+        queryStart = url.length();
+    
+    pthread_mutex_lock(&mutex);
+    
+    // Headers, with lower case names and trimmed values, and the host
+    size_t numHeaders = 0;
+    pair<string, string> & host = Entry(headers, numHeaders++);
+    host.first = "host";
+    host.second.assign(url, hostStart, pathStart - hostStart);
+    // libcurl leaves out default ports
+    string::size_type port = host.second.rfind(':');
+    if(port != string::npos &&
+       ((hostStart == 8 && host.second.compare(port, string::npos, ":443") == 0) ||
+        (hostStart == 7 && host.second.compare(port, string::npos, ":80") == 0)))
+        host.second.erase(port);
+    for(size_t j = 0; j < host.second.length(); ++j)
+        host.second[j] = tolower(host.second[j]);
+    
+    for(size_t h = 0; h < sendHeaders.Size(); ++h) {
+        pair<string, string> & header = Entry(headers, numHeaders++);
+        HeaderView name = sendHeaders.Name(h), value = sendHeaders.Value(h);
+        header.first.assign(name.data, name.length);
+        for(size_t j = 0; j < header.first.length(); ++j)
+            header.first[j] = tolower(header.first[j]);
+        size_t first = 0, last = value.length;
+        while(first < last && (value.data[first] == ' ' || value.data[first] == '\t'))
+            ++first;
+        while(last > first && (value.data[last-1] == ' ' || value.data[last-1] == '\t'))
+            --last;
+        header.second.assign(value.data + first, last - first);
+    }
+    SortEntries(headers, numHeaders);
+    
+    const char * amzDate = "";
+    const char * payloadHash = kUnsignedPayload;
+    for(size_t j = 0; j < numHeaders; ++j) {
+        if(headers[j].first == "x-amz-date")
+            amzDate = headers[j].second.c_str();
+        else if(headers[j].first == "x-amz-content-sha256")
+            payloadHash = headers[j].second.c_str();
+    }
+    if(strlen(amzDate) < 8)
+        amzDate = "19700101T000000Z";// not a valid request, but don't read past the end
+    if(strncmp(keyDate, amzDate, 8) != 0)
+        DeriveKey(amzDate);
+    
+    // Canonical request:
+    // METHOD\nPATH\nQUERY\nHEADER:VALUE\n...\n\nSIGNED;HEADERS\nPAYLOAD_HASH
+    canonical.clear();
+    canonical += method;
+    canonical += '\n';
+    if(queryStart > pathStart && url[pathStart] == '/')
+        AppendURIEncoded(canonical, url.data() + pathStart, queryStart - pathStart, true);
+    else
+        canonical += '/';
+    canonical += '\n';
+    
+    // Query parameters, sorted by encoded name
+    size_t numParams = 0;
+    string::size_type crsr = queryStart + 1;
+    while(crsr < url.length()) {
+        string::size_type end = url.find('&', crsr);
+        if(end == string::npos)
+            end = url.length();
+        if(end > crsr) {
+            string::size_type eq = url.find('=', crsr);
+            if(eq == string::npos || eq > end)
+                eq = end;
+            pair<string, string> & param = Entry(params, numParams++);
+            AppendURIEncoded(param.first, url.data() + crsr, eq - crsr, false);
+            if(eq < end)
+                AppendURIEncoded(param.second, url.data() + eq + 1, end - eq - 1, false);
+        }
+        crsr = end + 1;
+    }
+    SortEntries(params, numParams);
+    for(size_t j = 0; j < numParams; ++j) {
+        if(j > 0)
+            canonical += '&';
+        canonical += params[j].first;
+        canonical += '=';
+        canonical += params[j].second;
+    }
+    canonical += '\n';
+    
+    // Repeated headers are combined, values separated by commas
+    for(size_t j = 0; j < numHeaders; ++j) {
+        if(j > 0 && headers[j].first == headers[j-1].first) {
+            canonical[canonical.length() - 1] = ',';
+        }
+        else {
+            canonical += headers[j].first;
+            canonical += ':';
+        }
+        canonical += headers[j].second;
+        canonical += '\n';
+    }
+    canonical += '\n';
+    size_t signedStart = canonical.length();
+    for(size_t j = 0; j < numHeaders; ++j) {
+        if(j > 0 && headers[j].first == headers[j-1].first)
+            continue;
+        if(j > 0)
+            canonical += ';';
+        canonical += headers[j].first;
+    }
+    size_t signedLength = canonical.length() - signedStart;
+    canonical += '\n';
+    canonical += payloadHash;
+    
+    uint8_t md[SHA256_DIGEST_LENGTH];
+    char hex[2*SHA256_DIGEST_LENGTH];
+    SHA256((const uint8_t *)canonical.data(), canonical.length(), md);
+    EncodeHex(hex, md, sizeof(md));
+    
+    stringToSign.clear();
+    stringToSign += "AWS4-HMAC-SHA256\n";
+    stringToSign += amzDate;
+    stringToSign += '\n';
+    stringToSign += scope;
+    stringToSign += '\n';
+    stringToSign.append(hex, sizeof(hex));
+    
+    HMAC(stringToSign.data(), stringToSign.length(), md);
+    EncodeHex(signature, md, sizeof(md));
+    signature[64] = '\0';
+    
+    authorization.clear();
+    authorization += "AWS4-HMAC-SHA256 Credential=";
+    authorization += keyID;
+    authorization += '/';
+    authorization += scope;
+    authorization += ", SignedHeaders=";
+    authorization.append(canonical, signedStart, signedLength);
+    authorization += ", Signature=";
+    authorization.append(signature, 64);
+    
+    pthread_mutex_unlock(&mutex);
+}
+
+void AWS_SigV4::SignChunk(const char * amzDate, const char prevSignature[65],
+                          const char * data, size_t length, char signature[65])
+{
+    uint8_t md[SHA256_DIGEST_LENGTH];
+    char hex[2*SHA256_DIGEST_LENGTH];
+    SHA256((const uint8_t *)data, length, md);
+    EncodeHex(hex, md, sizeof(md));
+    
+    pthread_mutex_lock(&mutex);
+    if(strncmp(keyDate, amzDate, 8) != 0)
+        DeriveKey(amzDate);
+    
+    // AWS4-HMAC-SHA256-PAYLOAD\nDATE\nSCOPE\nPREVIOUS_SIGNATURE\nEMPTY_HASH\nDATA_HASH
+    stringToSign.clear();
+    stringToSign += "AWS4-HMAC-SHA256-PAYLOAD\n";
+    stringToSign += amzDate;
+    stringToSign += '\n';
+    stringToSign += scope;
+    stringToSign += '\n';
+    stringToSign.append(prevSignature, 64);
+    stringToSign += '\n';
+    stringToSign += kEmptyPayload;
+    stringToSign += '\n';
+    stringToSign.append(hex, sizeof(hex));
+    
+    HMAC(stringToSign.data(), stringToSign.length(), md);
+    pthread_mutex_unlock(&mutex);
+    
+    EncodeHex(signature, md, sizeof(md));
+    signature[64] = '\0';
+}
+
+//******************************************************************************
+
+static size_t HexDigits(size_t n)
+{
+    size_t digits = 1;
+    while(n >= 16) {
+        n >>= 4;
+        ++digits;
+    }
+    return digits;
+}
+
+// Framing around n bytes of data: HEX_SIZE;chunk-signature=SIGNATURE\r\n...\r\n
+static size_t FrameOverhead(size_t n)
+{
+    return HexDigits(n) + kChunkSignatureLen + 64 + 4;
+}
+
+AWS_ChunkedPayload::AWS_ChunkedPayload(AWS_SigV4 & s, const char * date, const char seed[65],
+                                       size_t dataLength, size_t cs):
+    signer(s),
+    chunkSize((cs < 1)? 1 : cs),
+    dataLeft(dataLength), dataRead(0),
+    frameLength(0), framePos(0),
+    done(false)
+{
+    strncpy(amzDate, date, 16);
+    amzDate[16] = '\0';
+    memcpy(signature, seed, 64);
+    signature[64] = '\0';
+}
+
+size_t AWS_ChunkedPayload::EncodedLength(size_t dataLength, size_t chunkSize)
+{
+    if(chunkSize < 1)
+        chunkSize = 1;
+    size_t full = dataLength/chunkSize, rest = dataLength%chunkSize;
+    size_t length = full*(FrameOverhead(chunkSize) + chunkSize);
+    if(rest > 0)
+        length += FrameOverhead(rest) + rest;
+    return length + FrameOverhead(0);
+}
+
+bool AWS_ChunkedPayload::NextFrame(istream & istrm)
+{
+    size_t n = min(chunkSize, dataLeft);
+    size_t digits = HexDigits(n);
+    size_t header = digits + kChunkSignatureLen + 64 + 2;
+    frameLength = header + n + 2;
+    if(frame.size() < frameLength)
+        frame.resize(frameLength);
+    
+    // Read the data into place, then sign it and fill in the header
+    char * f = &frame[0];
+    if(n > 0) {
+        istrm.read(f + header, n);
+        if((size_t)istrm.gcount() != n) {
+            frameLength = framePos = 0;
+            return false;
+        }
+    }
+    signer.SignChunk(amzDate, signature, f + header, n, signature);
+    
+    for(size_t j = 0, v = n; j < digits; ++j, v >>= 4)
+        f[digits - 1 - j] = "0123456789abcdef"[v & 0x0F];
+    memcpy(f + digits, kChunkSignature, kChunkSignatureLen);
+    memcpy(f + digits + kChunkSignatureLen, signature, 64);
+    memcpy(f + header - 2, "\r\n", 2);
+    memcpy(f + header + n, "\r\n", 2);
+    
+    dataLeft -= n;
+    dataRead += n;
+    framePos = 0;
+    done = (n == 0);
+    return true;
+}
+
+size_t AWS_ChunkedPayload::Read(istream & istrm, char * buf, size_t length)
+{
+    size_t count = 0;
+    while(count < length) {
+        if(framePos == frameLength && (done || !NextFrame(istrm)))
+            break;
+        size_t n = min(length - count, frameLength - framePos);
+        memcpy(buf + count, &frame[framePos], n);
+        count += n;
+        framePos += n;
+    }
+    return count;
+}
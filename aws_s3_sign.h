@@ -0,0 +1,136 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_SIGN_H
+#define AWS_S3_SIGN_H
+
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <pthread.h>
+#include <openssl/sha.h>
+#include "aws_s3_headers.h"
+
+// AWS Signature Version 4, for S3 requests:
+// http://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-authenticating-requests.html
+// 
+// The signing key is derived from the secret, date, region and service with four
+// HMACs, and kept for the rest of the day as the SHA-256 states of its inner and
+// outer HMAC pads. Each signature then only hashes the string to sign. Canonical
+// requests are assembled in buffers kept between calls, without iostreams.
+// Sign() and SignChunk() may be called from several threads.
+class AWS_SigV4 {
+    std::string keyID, secret, region, service;
+    
+    pthread_mutex_t mutex;
+    char keyDate[9];// YYYYMMDD the signing key was derived for
+    SHA256_CTX inner, outer;// HMAC state keyed with the signing key
+    std::string scope;// DATE/REGION/SERVICE/aws4_request
+    
+    // Reused between requests
+    std::vector<std::pair<std::string, std::string> > params, headers;
+    std::string canonical, stringToSign;
+    
+    void DeriveKey(const char * date);
+    void HMAC(const char * data, size_t length, uint8_t md[SHA256_DIGEST_LENGTH]) const;
+    
+    // Not copyable
+    AWS_SigV4(const AWS_SigV4 &);
+    AWS_SigV4 & operator=(const AWS_SigV4 &);
+    
+  public:
+    // Values of x-amz-content-sha256
+    static const char * kEmptyPayload;// SHA-256 of no data
+    static const char * kUnsignedPayload;
+    static const char * kStreamingPayload;// see AWS_ChunkedPayload
+    
+    AWS_SigV4(const std::string & keyID, const std::string & secret,
+              const std::string & region = "us-east-1", const std::string & service = "s3");
+    ~AWS_SigV4();
+    
+    void SetRegion(const std::string & r);
+    const std::string & GetRegion() const {return region;}
+    
+    // Format t as x-amz-date wants it, "20130524T000000Z"
+    static void AmzDate(char date[17], time_t t);
+    
+    // Hex SHA-256 of the next length bytes of istrm, which is left where it was.
+    // Returns false if istrm can not be repositioned.
+    static bool HashPayload(std::istream & istrm, size_t length, char hash[65]);
+    
+    // Sign a request for url with the given headers, which must include x-amz-date
+    // and x-amz-content-sha256. The Host header is taken from url. Sets
+    // authorization to the value of the Authorization header, and signature to the
+    // request's signature in hex, the seed for chunk signatures.
+    void Sign(const std::string & method, const std::string & url, const AWS_Headers & sendHeaders,
+              std::string & authorization, char signature[65]);
+    
+    // Sign one chunk of a streaming payload, chained from the signature of the
+    // previous chunk, or of the request for the first.
+    void SignChunk(const char * amzDate, const char prevSignature[65],
+                   const char * data, size_t length, char signature[65]);
+};
+
+// The body of a request signed with STREAMING-AWS4-HMAC-SHA256-PAYLOAD: the data
+// in chunks, each framed as
+// HEX_SIZE;chunk-signature=SIGNATURE\r\nDATA\r\n
+// and ending with an empty chunk. Chunks are hashed and signed as they are sent,
+// so the data needs no separate pass to hash it before the request.
+class AWS_ChunkedPayload {
+    AWS_SigV4 & signer;
+    char amzDate[17];
+    char signature[65];
+    size_t chunkSize;
+    size_t dataLeft, dataRead;
+    std::vector<char> frame;
+    size_t frameLength, framePos;
+    bool done;
+    
+    bool NextFrame(std::istream & istrm);
+    
+  public:
+    static const size_t kChunkSize = 64*1024;
+    
+    // seed is the signature of the request
+    AWS_ChunkedPayload(AWS_SigV4 & s, const char * amzDate, const char seed[65],
+                       size_t dataLength, size_t chunkSize = kChunkSize);
+    
+    // Length of the encoded body for dataLength bytes of data, the Content-Length
+    static size_t EncodedLength(size_t dataLength, size_t chunkSize = kChunkSize);
+    
+    // Fill buf with up to length bytes of the encoded body, reading the data from
+    // istrm. Returns 0 once the body is complete, or if istrm ends early.
+    size_t Read(std::istream & istrm, char * buf, size_t length);
+    
+    // Bytes of data read so far
+    size_t DataRead() const {return dataRead;}
+};
+
+#endif // AWS_S3_SIGN_H
@@ -0,0 +1,156 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <iostream>
+
+#include "aws_s3_transfer.h"
+#include "aws_s3_pool.h"
+
+using namespace std;
+
+AWS_Transfer::AWS_Transfer(size_t n):
+    multi(curl_multi_init()),
+    maxActive((n < 1)? 1 : n),
+    callbackDepth(0)
+{
+}
+
+AWS_Transfer::~AWS_Transfer()
+{
+    // Abandon anything still outstanding. Callers that care about the results
+    // should call Finish() first.
+    map<CURL *, Request>::iterator req;
+    for(req = active.begin(); req != active.end(); ++req) {
+        curl_multi_remove_handle(multi, req->first);
+        req->second.io->error = true;
+        delete req->second.conn;
+    }
+    list<Request>::iterator p;
+    for(p = pending.begin(); p != pending.end(); ++p) {
+        p->io->error = true;
+        delete p->conn;
+    }
+    curl_multi_cleanup(multi);
+}
+
+void AWS_Transfer::Add(AWS_Connection * conn, AWS_IO & io)
+{
+    pending.push_back(Request(conn, &io));
+    StartPending();
+    
+    // From within a completion handler the caller is already running the event
+    // loop, so just leave the request queued.
+    if(callbackDepth == 0) {
+        while(!pending.empty())
+            Step();
+    }
+}
+
+size_t AWS_Transfer::Step(int timeoutMS)
+{
+    StartPending();
+    if(!active.empty())
+    {
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        
+        int msgsLeft = 0;
+        CURLMsg * msg;
+        while((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL) {
+            if(msg->msg == CURLMSG_DONE)
+                Complete(msg->easy_handle, msg->data.result);
+        }
+        
+        StartPending();
+        if(!active.empty())
+            curl_multi_wait(multi, NULL, 0, timeoutMS, NULL);
+    }
+    return active.size() + pending.size();
+}
+
+void AWS_Transfer::Wait(const AWS_IO & io)
+{
+    while(Queued(io))
+        Step();
+}
+
+void AWS_Transfer::Finish()
+{
+    while(Step() > 0)
+        ;
+}
+
+bool AWS_Transfer::Queued(const AWS_IO & io) const
+{
+    map<CURL *, Request>::const_iterator req;
+    for(req = active.begin(); req != active.end(); ++req)
+        if(req->second.io == &io)
+            return true;
+    list<Request>::const_iterator p;
+    for(p = pending.begin(); p != pending.end(); ++p)
+        if(p->io == &io)
+            return true;
+    return false;
+}
+
+void AWS_Transfer::StartPending()
+{
+    while(active.size() < maxActive && !pending.empty())
+    {
+        Request req = pending.front();
+        pending.pop_front();
+        
+        CURL * handle = req.conn->getHandle();
+        req.io->WillStart();
+        active.insert(make_pair(handle, req));
+        curl_multi_add_handle(multi, handle);
+    }
+}
+
+void AWS_Transfer::Complete(CURL * handle, CURLcode code)
+{
+    map<CURL *, Request>::iterator req = active.find(handle);
+    if(req == active.end())
+        return;
+    
+    Request done = req->second;
+    active.erase(req);
+    curl_multi_remove_handle(multi, handle);
+    AWS_ConnectionPool::Count(handle);
+    
+    if(code != CURLE_OK) {
+        done.io->error = true;
+        cerr << "Error: " << curl_easy_strerror(code) << endl;
+    }
+    
+    // The handler may queue follow-up requests, possibly reusing the same AWS_IO.
+    ++callbackDepth;
+    done.io->DidFinish();
+    --callbackDepth;
+    
+    delete done.conn;
+}
@@ -0,0 +1,99 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_TRANSFER_H
+#define AWS_S3_TRANSFER_H
+
+#include <list>
+#include <map>
+
+#include <curl/multi.h>
+#include "aws_s3.h"
+
+// Runs many requests at once on a single libcurl multi handle. An AWS_IO with
+// its transfer member pointing at an AWS_Transfer has its request queued here
+// by AWS::Send() instead of being performed immediately:
+// 
+// AWS_Transfer xfer(8);
+// io.transfer = &xfer;
+// aws.PutObject("bucket", "key", "", io);
+// ...
+// xfer.Finish();
+// 
+// At most maxActive requests are in flight at any time. Add() blocks, running
+// the event loop, until the new request can be started, so the number of
+// queued requests stays bounded. Requests may also be added from within
+// AWS_IO::DidFinish(), in which case they are queued without blocking.
+// 
+// curlpp's Multi wrapper does not expose multi handle options or
+// curl_multi_wait(), so the libcurl multi interface is used directly.
+class AWS_Transfer {
+    struct Request {
+        AWS_Connection * conn;
+        AWS_IO * io;
+        Request(AWS_Connection * c, AWS_IO * i): conn(c), io(i) {}
+    };
+    
+    CURLM * multi;
+    size_t maxActive;
+    std::list<Request> pending;
+    std::map<CURL *, Request> active;
+    int callbackDepth;
+    
+    void StartPending();
+    void Complete(CURL * handle, CURLcode code);
+    
+    // Not copyable
+    AWS_Transfer(const AWS_Transfer &);
+    AWS_Transfer & operator=(const AWS_Transfer &);
+    
+  public:
+    AWS_Transfer(size_t maxActive = 4);
+    ~AWS_Transfer();
+    
+    void SetMaxActive(size_t n) {maxActive = (n < 1)? 1 : n;}
+    size_t GetMaxActive() const {return maxActive;}
+    
+    // Queue a prepared request. The transfer takes ownership of conn, which is
+    // deleted once the request completes.
+    void Add(AWS_Connection * conn, AWS_IO & io);
+    
+    // Perform one round of the event loop, waiting up to timeoutMS milliseconds
+    // for activity. Returns the number of requests still active or pending.
+    size_t Step(int timeoutMS = 100);
+    
+    // Run the event loop until the request for io has completed.
+    void Wait(const AWS_IO & io);
+    
+    // Run the event loop until all queued requests have completed.
+    void Finish();
+    
+    bool Queued(const AWS_IO & io) const;
+    bool Idle() const {return active.empty() && pending.empty();}
+};
+
+#endif // AWS_S3_TRANSFER_H
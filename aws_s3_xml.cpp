@@ -0,0 +1,335 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <cstring>
+
+#include "aws_s3_xml.h"
+#include "aws_s3_misc.h"
+
+using namespace std;
+
+//******************************************************************************
+// AWS_XMLParser
+//******************************************************************************
+
+void AWS_XMLParser::Reset()
+{
+    path = "";
+    pathLengths.clear();
+    tag = "";
+    text = "";
+    textView = XMLView();
+    inTag = false;
+    failed = false;
+}
+
+void AWS_XMLParser::Parse(const char * buf, size_t len)
+{
+    const char * end = buf + len;
+    while(buf < end)
+    {
+        if(inTag) {
+            const char * close = (const char *)memchr(buf, '>', end - buf);
+            if(close == NULL) {
+                tag.append(buf, end - buf);
+                break;
+            }
+            if(tag.empty()) {
+                HandleTag(buf, close - buf);
+            }
+            else {
+                tag.append(buf, close - buf);
+                HandleTag(tag.data(), tag.length());
+                tag = "";
+            }
+            text = "";
+            textView = XMLView();
+            buf = close + 1;
+            inTag = false;
+        }
+        else {
+            const char * open = (const char *)memchr(buf, '<', end - buf);
+            if(open == NULL) {
+                text.append(buf, end - buf);
+                return;
+            }
+            if(text.empty()) {
+                textView = XMLView(buf, open - buf);
+            }
+            else {
+                text.append(buf, open - buf);
+                textView = XMLView(text.data(), text.length());
+            }
+            buf = open + 1;
+            inTag = true;
+        }
+    }
+    
+    // The text before a tag continued in the next chunk must outlive this one
+    if(inTag && text.empty()) {
+        text.assign(textView.data, textView.length);
+        textView = XMLView(text.data(), text.length());
+    }
+}
+
+static inline bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void AWS_XMLParser::HandleTag(const char * tag, size_t length)
+{
+    if(length == 0 || tag[0] == '?' || tag[0] == '!')
+        return;
+    
+    if(tag[0] == '/') {
+        size_t nameLength = 1;
+        while(nameLength < length && !IsSpace(tag[nameLength]))
+            ++nameLength;
+        --nameLength;
+        string::size_type parentLength = pathLengths.empty()? 0 : pathLengths.back();
+        string::size_type nameStart = (parentLength == 0)? 0 : parentLength + 1;
+        if(pathLengths.empty() || path.compare(nameStart, string::npos, tag + 1, nameLength) != 0) {
+            failed = true;
+            return;
+        }
+        EndElement(path, textView);
+        path.resize(parentLength);
+        pathLengths.pop_back();
+        return;
+    }
+    
+    bool empty = (tag[length - 1] == '/');
+    size_t nameLength = 0;
+    while(nameLength < length && !IsSpace(tag[nameLength]) && tag[nameLength] != '/')
+        ++nameLength;
+    pathLengths.push_back(path.length());
+    if(!path.empty())
+        path += '/';
+    path.append(tag, nameLength);
+    StartElement(path);
+    if(empty) {
+        EndElement(path, XMLView());
+        path.resize(pathLengths.back());
+        pathLengths.pop_back();
+    }
+}
+
+//******************************************************************************
+// Response parsers
+//******************************************************************************
+
+void AWS_ObjectListParser::Reset()
+{
+    AWS_XMLParser::Reset();
+    truncated = false;
+    nextMarker = "";
+    lastKey = "";
+}
+
+void AWS_ObjectListParser::StartElement(const string & path)
+{
+    if(PathIs(path, "ListBucketResult/Contents")) {
+        obj.key = "";
+        obj.lastModified = "";
+        obj.eTag = "";
+        obj.size = "";
+        obj.ownerID = "";
+        obj.ownerDisplayName = "";
+        obj.storageClass = "";
+    }
+}
+
+void AWS_ObjectListParser::EndElement(const string & path, const XMLView & text)
+{
+    static const char contents[] = "ListBucketResult/Contents";
+    static const size_t field = sizeof(contents);// past the '/'
+    if(path.compare(0, field - 1, contents) == 0)
+    {
+        if(path.length() == field - 1) {
+            lastKey = obj.key;
+            Object(obj);
+        }
+        else if(PathIs(path, "Key", field))
+            text.Decode(obj.key);
+        else if(PathIs(path, "LastModified", field))
+            text.Decode(obj.lastModified);
+        else if(PathIs(path, "ETag", field)) {
+            // eTag starts and ends with ", remove these
+            text.Decode(obj.eTag);
+            if(obj.eTag.length() >= 2 && obj.eTag[0] == '"') {
+                obj.eTag.erase(obj.eTag.length() - 1);
+                obj.eTag.erase(0, 1);
+            }
+        }
+        else if(PathIs(path, "Size", field))
+            text.Decode(obj.size);
+        else if(PathIs(path, "Owner/ID", field))
+            text.Decode(obj.ownerID);
+        else if(PathIs(path, "Owner/DisplayName", field))
+            text.Decode(obj.ownerDisplayName);
+        else if(PathIs(path, "StorageClass", field))
+            text.Decode(obj.storageClass);
+    }
+    else if(PathIs(path, "ListBucketResult/CommonPrefixes/Prefix")) {
+        if(commonPrefixes)
+            commonPrefixes->push_back(text.Decoded());
+    }
+    else if(PathIs(path, "ListBucketResult/IsTruncated")) {
+        truncated = (text == "true");
+    }
+    else if(PathIs(path, "ListBucketResult/NextMarker")) {
+        text.Decode(nextMarker);
+    }
+}
+
+void AWS_ObjectListParser::Object(const AWS_S3_Object & obj)
+{
+    objects.Add(obj);
+}
+
+void AWS_BucketListParser::EndElement(const string & path, const XMLView & text)
+{
+    if(PathIs(path, "ListAllMyBucketsResult/Buckets/Bucket/Name")) {
+        text.Decode(name);
+    }
+    else if(PathIs(path, "ListAllMyBucketsResult/Buckets/Bucket/CreationDate")) {
+        text.Decode(date);
+    }
+    else if(PathIs(path, "ListAllMyBucketsResult/Buckets/Bucket")) {
+        buckets.push_back(AWS_S3_Bucket(name, date));
+        name = "";
+        date = "";
+    }
+    else if(PathIs(path, "ListAllMyBucketsResult/Owner/ID")) {
+        text.Decode(ownerID);
+    }
+    else if(PathIs(path, "ListAllMyBucketsResult/Owner/DisplayName")) {
+        text.Decode(ownerDisplayName);
+    }
+}
+
+void AWS_VersionListParser::EndElement(const string & path, const XMLView & text)
+{
+    if(PathIs(path, "ListVersionsResult/Version/Key") ||
+       PathIs(path, "ListVersionsResult/DeleteMarker/Key"))
+    {
+        text.Decode(key);
+    }
+    else if(PathIs(path, "ListVersionsResult/Version/VersionId") ||
+            PathIs(path, "ListVersionsResult/DeleteMarker/VersionId"))
+    {
+        text.Decode(versionId);
+    }
+    else if(PathIs(path, "ListVersionsResult/Version") ||
+            PathIs(path, "ListVersionsResult/DeleteMarker"))
+    {
+        keys.push_back(key);
+        versionIds.push_back(versionId);
+        key = "";
+        versionId = "";
+    }
+    else if(PathIs(path, "ListVersionsResult/IsTruncated")) {
+        truncated = (text == "true");
+    }
+    else if(PathIs(path, "ListVersionsResult/NextKeyMarker")) {
+        text.Decode(nextKeyMarker);
+    }
+    else if(PathIs(path, "ListVersionsResult/NextVersionIdMarker")) {
+        text.Decode(nextVersionIdMarker);
+    }
+}
+
+void AWS_DeleteResultParser::EndElement(const string & path, const XMLView & text)
+{
+    if(PathIs(path, "DeleteResult/Deleted")) {
+        ++deleted;
+    }
+    else if(PathIs(path, "DeleteResult/Error/Key")) {
+        text.Decode(error.key);
+    }
+    else if(PathIs(path, "DeleteResult/Error/Code")) {
+        text.Decode(error.code);
+    }
+    else if(PathIs(path, "DeleteResult/Error/Message")) {
+        text.Decode(error.message);
+    }
+    else if(PathIs(path, "DeleteResult/Error")) {
+        errors.push_back(error);
+        error = Error();
+    }
+}
+
+void AWS_UploadListParser::EndElement(const string & path, const XMLView & text)
+{
+    if(PathIs(path, "ListMultipartUploadsResult/Upload/Key")) {
+        text.Decode(upload.key);
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/Upload/UploadId")) {
+        text.Decode(upload.uploadId);
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/Upload/Initiated")) {
+        text.Decode(upload.initiated);
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/Upload")) {
+        uploads.push_back(upload);
+        upload = Upload();
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/IsTruncated")) {
+        truncated = (text == "true");
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/NextKeyMarker")) {
+        text.Decode(nextKeyMarker);
+    }
+    else if(PathIs(path, "ListMultipartUploadsResult/NextUploadIdMarker")) {
+        text.Decode(nextUploadIdMarker);
+    }
+}
+
+bool AWS_UploadListParser::NextPage(string & keyMarker, string & uploadIdMarker) const
+{
+    if(!truncated || nextKeyMarker == "" ||
+       (nextKeyMarker == keyMarker && nextUploadIdMarker == uploadIdMarker))
+        return false;
+    keyMarker = nextKeyMarker;
+    uploadIdMarker = nextUploadIdMarker;
+    return true;
+}
+
+//******************************************************************************
+// AWS_XMLIO
+//******************************************************************************
+
+size_t AWS_XMLIO::Write(char * buf, size_t size, size_t nmemb)
+{
+    if(numResult/100 != 2)
+        return AWS_IO::Write(buf, size, nmemb);
+    
+    parser.Parse(buf, size*nmemb);
+    bytesReceived += size*nmemb;
+    return size*nmemb;
+}
@@ -0,0 +1,240 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#ifndef AWS_S3_XML_H
+#define AWS_S3_XML_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+
+#include "aws_s3.h"
+#include "aws_s3_misc.h"
+
+// Incremental parser for the XML documents returned by S3. The document may be
+// fed in chunks split at any point, as they arrive from the network, so a
+// response never needs to be held in full.
+// 
+// Only what S3 produces is handled: nested elements with text content and the
+// predefined and numeric entities. Attributes, processing instructions and
+// comments are skipped. Subclasses receive each element by its path from the
+// root, for example "ListBucketResult/Contents/Key", with a view of the text it
+// directly contains. The view is only valid during the call, and entities in it
+// are not yet decoded: use text.Decoded() to get a copy of the text.
+// Text and tags are only copied when they span two chunks.
+class AWS_XMLParser {
+    std::string path;
+    std::vector<std::string::size_type> pathLengths;
+    std::string tag;// tag split between chunks
+    std::string text;// text split between chunks
+    XMLView textView;
+    bool inTag;
+    bool failed;
+    
+    void HandleTag(const char * tag, size_t length);
+    
+  protected:
+    virtual void StartElement(const std::string & path) {}
+    virtual void EndElement(const std::string & path, const XMLView & text) {}
+    
+    // Compare the part of path starting at pos with a string literal. Handlers
+    // make many such comparisons per element, so the length is checked first.
+    template<size_t N>
+    static bool PathIs(const std::string & path, const char (&lit)[N], size_t pos = 0) {
+        return path.length() == pos + N - 1 && memcmp(path.data() + pos, lit, N - 1) == 0;
+    }
+    
+  public:
+    AWS_XMLParser() {Reset();}
+    virtual ~AWS_XMLParser() {}
+    
+    // Prepare for a new document
+    virtual void Reset();
+    
+    // Parse the next len bytes of the document
+    void Parse(const char * buf, size_t len);
+    void Parse(const std::string & str) {Parse(str.data(), str.length());}
+    
+    // True if mismatched closing tags were found
+    bool Failed() const {return failed;}
+};
+
+// Collects the objects and common prefixes of a ListBucketResult.
+class AWS_ObjectListParser: public AWS_XMLParser {
+    AWS_S3_Object obj;
+    
+  protected:
+    virtual void StartElement(const std::string & path);
+    virtual void EndElement(const std::string & path, const XMLView & text);
+    
+    // Called as each <Contents> element completes, adds to objects.
+    virtual void Object(const AWS_S3_Object & obj);
+    
+  public:
+    AWS_S3_Catalog & objects;
+    std::list<std::string> * commonPrefixes;
+    
+    bool truncated;
+    std::string nextMarker;
+    std::string lastKey;
+    
+    AWS_ObjectListParser(AWS_S3_Catalog & objs, std::list<std::string> * prefixes = NULL):
+        objects(objs), commonPrefixes(prefixes), truncated(false)
+    {}
+    
+    // Prepare for another page of the listing
+    virtual void Reset();
+    
+    // Key to continue a truncated listing from. NextMarker is only returned when
+    // a delimiter was given, otherwise the last key is used.
+    const std::string & Marker() const {return (nextMarker != "")? nextMarker : lastKey;}
+};
+
+// Collects the buckets of a ListAllMyBucketsResult.
+class AWS_BucketListParser: public AWS_XMLParser {
+    std::string name, date;
+    
+  protected:
+    virtual void EndElement(const std::string & path, const XMLView & text);
+    
+  public:
+    std::list<AWS_S3_Bucket> & buckets;
+    std::string ownerID;
+    std::string ownerDisplayName;
+    
+    AWS_BucketListParser(std::list<AWS_S3_Bucket> & bkts): buckets(bkts) {}
+};
+
+// Collects the versions and delete markers of a ListVersionsResult, with the
+// version ID of each key in the matching entry of versionIds.
+class AWS_VersionListParser: public AWS_XMLParser {
+    std::string key, versionId;
+    
+  protected:
+    virtual void EndElement(const std::string & path, const XMLView & text);
+    
+  public:
+    std::vector<std::string> keys;
+    std::vector<std::string> versionIds;
+    
+    bool truncated;
+    std::string nextKeyMarker;
+    std::string nextVersionIdMarker;
+    
+    AWS_VersionListParser(): truncated(false) {}
+    
+    virtual void Reset() {
+        AWS_XMLParser::Reset();
+        keys.clear();
+        versionIds.clear();
+        truncated = false;
+        nextKeyMarker = "";
+        nextVersionIdMarker = "";
+    }
+};
+
+// Collects the outcome of a Multi-Object Delete from its DeleteResult. In quiet
+// mode only the keys that could not be deleted are listed.
+class AWS_DeleteResultParser: public AWS_XMLParser {
+  public:
+    struct Error {
+        std::string key;
+        std::string code;
+        std::string message;
+    };
+    
+  private:
+    Error error;
+    
+  protected:
+    virtual void EndElement(const std::string & path, const XMLView & text);
+    
+  public:
+    std::list<Error> errors;
+    size_t deleted;
+    
+    AWS_DeleteResultParser(): deleted(0) {}
+    
+    virtual void Reset() {
+        AWS_XMLParser::Reset();
+        errors.clear();
+        deleted = 0;
+    }
+};
+
+// Collects one page of in-progress multipart uploads from a
+// ListMultipartUploadsResult.
+class AWS_UploadListParser: public AWS_XMLParser {
+  public:
+    struct Upload {
+        std::string key;
+        std::string uploadId;
+        std::string initiated;
+    };
+    
+  private:
+    Upload upload;
+    
+  protected:
+    virtual void EndElement(const std::string & path, const XMLView & text);
+    
+  public:
+    std::list<Upload> uploads;
+    
+    bool truncated;
+    std::string nextKeyMarker;
+    std::string nextUploadIdMarker;
+    
+    AWS_UploadListParser(): truncated(false) {}
+    
+    // Move the markers on to the next page. Returns false at the end of the
+    // listing, or if a truncated response gives no markers past the current
+    // ones, which would only ask for the same page again.
+    bool NextPage(std::string & keyMarker, std::string & uploadIdMarker) const;
+    
+    virtual void Reset() {
+        AWS_XMLParser::Reset();
+        uploads.clear();
+        truncated = false;
+        nextKeyMarker = "";
+        nextUploadIdMarker = "";
+    }
+};
+
+// AWS_IO that feeds the body of a successful response to a parser as it is
+// received. Error responses are collected in response as usual.
+struct AWS_XMLIO: public AWS_IO {
+    AWS_XMLParser & parser;
+    
+    AWS_XMLIO(AWS_XMLParser & p): parser(p) {}
+    
+    virtual size_t Write(char * buf, size_t size, size_t nmemb);
+};
+
+//******************************************************************************
+#endif // AWS_S3_XML_H
@@ -0,0 +1,87 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "loopback_server.h"
+
+const char kLoopbackObject[] = "0123456789abcdef";
+
+const char kLoopbackResponse[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 16\r\n"
+    "\r\n"
+    "0123456789abcdef";
+
+static void * LoopbackServer(void * ctx)
+{
+    int listener = *(int *)ctx;
+    int conn;
+    while((conn = accept(listener, NULL, NULL)) >= 0) {
+        char buf[16384];
+        size_t have = 0;
+        ssize_t n;
+        while((n = read(conn, buf + have, sizeof(buf) - have - 1)) > 0) {
+            have += n;
+            buf[have] = '\0';
+            // Requests have no body, answer each complete header
+            char * end;
+            while((end = strstr(buf, "\r\n\r\n")) != NULL) {
+                if(write(conn, kLoopbackResponse, sizeof(kLoopbackResponse) - 1) < 0)
+                    break;
+                end += 4;
+                have -= end - buf;
+                memmove(buf, end, have + 1);
+            }
+        }
+        close(conn);
+    }
+    return NULL;
+}
+
+int StartLoopbackServer()
+{
+    static int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(listener < 0 || bind(listener, (struct sockaddr *)&addr, len) != 0 || listen(listener, 4) != 0 ||
+       getsockname(listener, (struct sockaddr *)&addr, &len) != 0)
+        return 0;
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, LoopbackServer, &listener) != 0)
+        return 0;
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
@@ -28,11 +28,15 @@
 #include "aws_s3.h"
 #include "aws_s3_misc.h"
 #include "aws_s3_acl.h"
+#include "aws_s3_transfer.h"
+#include "aws_s3_pool.h"
 #include "mime_types.h"
 #include "multidict.h"
 #include "commandline.h"
 
 #include <cmath>
+#include <cstdio>
+#include <ctime>
 
 #include <exception>
 #include <stdexcept>
@@ -42,6 +46,8 @@
 
 #include <unistd.h>
 #include <pwd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -66,14 +72,22 @@ void LoadCredFile(const string & path, string & keyID, string & secret, string &
 void ParseMetadata(AWS_IO & io, const CommandLine & cmdln);
 void ParseObjPath(int & idx, const CommandLine & cmds, string & bucket, string & object);
 
-void PrintObject(const AWS_S3_Object & object, bool longFormat = false);
+void PrintObject(const AWS_S3_ObjectRef & object, bool longFormat = false);
 void PrintBucket(const AWS_S3_Bucket & bucket, bool bucketName = false);
 
+struct BulkIO;
+size_t GetJobs(const CommandLine & cmds);
+int ReapBulk(std::list<BulkIO *> & ios, const AWS_Transfer & xfer, const string & cmd);
+
 typedef int (*Command)(size_t wordc, CommandLine & cmds, AWS & aws);
 static std::map<string, Command> commands;
 
 static int verbosity = 1;
 static map<string, string> aliases;
+static string endpoint;// from the credentials file, if not the default
+static bool pathStyle = false;
+static string region;
+static int signatureVersion = 4;
 
 
 //******************************************************************************
@@ -88,6 +102,9 @@ int main(int argc, char * argv[])
     cmds.flagParams.insert("-p");// permissions (canned ACL)
     cmds.flagParams.insert("-t");// type (Content-Type)
     cmds.flagParams.insert("-m");// metadata
+    cmds.flagParams.insert("-j");// number of concurrent requests for bulk operations
+    cmds.flagParams.insert("-s");// part size for multipart uploads
+    cmds.flagParams.insert("-d");// age in days of uploads to list or abort
     cmds.Parse(argc, argv);
     size_t wordc = cmds.words.size();
     
@@ -138,6 +155,25 @@ int main(int argc, char * argv[])
     // Create and configure AWS instance
     AWS aws(keyID, secret);
     aws.SetVerbosity(verbosity);
+    if(endpoint != "" || pathStyle)
+        aws.SetEndpoint((endpoint != "")? endpoint : aws.GetEndpoint(), pathStyle);
+    if(region != "")
+        aws.SetRegion(region);
+    aws.SetSignatureVersion(signatureVersion);
+    if(cmds.FlagSet("-j")) {
+        aws.SetPartJobs(GetJobs(cmds));
+        aws.SetListJobs(GetJobs(cmds));
+    }
+    if(cmds.FlagSet("-s")) {
+        string sizeStr = cmds.opts.GetWithDefault("-s", "");
+        size_t partSize = 0;
+        if(!ParseSize(partSize, sizeStr)) {
+            cerr << "ERROR: invalid part size \"" << sizeStr << "\"" << endl;
+            cerr << "PART_SIZE is a number of bytes with an optional K, M or G suffix, e.g. 16M" << endl;
+            return EXIT_FAILURE;
+        }
+        aws.SetPartSize(partSize);
+    }
     
     // Remove executable name if called directly with commands, otherwise show usage
     // If symlinked, use the executable name to determine the desired operation
@@ -173,6 +209,17 @@ int main(int argc, char * argv[])
         if(cmds.words.size() >= 2 && cmds.FlagSet("-i")) {
             Command_s3genidx(wordc, cmds, aws);
         }
+        
+        // Connections are shared between requests, show how well that worked
+        if(verbosity >= 2) {
+            size_t requests, connects;
+            AWS_ConnectionPool::GetCounts(requests, connects);
+            bool https = aws.GetEndpoint().compare(0, 8, "https://") == 0;
+            cout << requests << " requests, " << connects << " new connections";
+            if(https)
+                cout << " (TLS handshakes)";
+            cout << endl;
+        }
     }
     else {
         cerr << "Did not understand command \"" << cmds.words[0] << "\"" << endl;
@@ -210,6 +257,17 @@ void LoadCredFile(const string & path, string & keyID, string & secret, string &
                 cred >> alias >> bucket;
                 aliases[alias] = bucket;
             }
+            else if(cmd == "endpoint")
+                cred >> endpoint;
+            else if(cmd == "addressing") {
+                string style;
+                cred >> style;
+                pathStyle = (style == "path");
+            }
+            else if(cmd == "region")
+                cred >> region;
+            else if(cmd == "signature")
+                cred >> signatureVersion;
         }
         if(verbosity >= 2)
             cout << "using credentials from " << path << ", name: " << name << endl;
@@ -259,9 +317,8 @@ void ParseMetadata(AWS_IO & io, const CommandLine & cmdln)
 void ParseObjPath(int & idx, const CommandLine & cmds, string & bucket, string & object)
 {
     // If first string contains a '/' or ':', treat as bucket and key. Else treat as bucket.
-    string::size_type crsr = cmds.words[idx].find('/');
-    if(crsr == string::npos)
-        crsr = cmds.words[idx].find(':');
+    // Bucket names contain neither, so the first one found ends the bucket name.
+    string::size_type crsr = cmds.words[idx].find_first_of("/:");
     
     if(crsr != string::npos)
     {
@@ -294,26 +351,26 @@ void ParseObjPath(int & idx, const CommandLine & cmds, string & bucket, string &
 }
 
 //******************************************************************************
-void PrintObject(const AWS_S3_Object & object, bool longFormat)
+void PrintObject(const AWS_S3_ObjectRef & object, bool longFormat)
 {
     if(longFormat)
     {
-        cout << object.key << endl;
-        cout << "  Last modified: " << object.lastModified << endl;
-        cout << "  eTag: " << object.eTag << endl;
+        cout << object.GetKey() << endl;
+        cout << "  Last modified: " << object.GetLastModified() << endl;
+        cout << "  eTag: " << object.GetETag() << endl;
         cout << "  Size: " << HumanSize(object.GetSize()) << endl;
-        cout << "  OwnerID: " << object.ownerID << endl;
-        cout << "  OwnerName: " << object.ownerDisplayName << endl;
-        cout << "  Storage class: " << object.storageClass << endl;
+        cout << "  OwnerID: " << object.GetOwnerID() << endl;
+        cout << "  OwnerName: " << object.GetOwnerDisplayName() << endl;
+        cout << "  Storage class: " << object.GetStorageClass() << endl;
     }
     else
     {
-        cout << object.key;
-        cout << " " << object.lastModified;
+        cout << object.GetKey();
+        cout << " " << object.GetLastModified();
         cout << ", " << HumanSize(object.GetSize());
-        cout << " " << object.ownerDisplayName;
-        cout << " " << object.storageClass;
-        cout << " " << object.eTag;
+        cout << " " << object.GetOwnerDisplayName();
+        cout << " " << object.GetStorageClass();
+        cout << " " << object.GetETag();
     }
 }
 
@@ -322,12 +379,347 @@ void PrintBucket(const AWS_S3_Bucket & bucket, bool bucketName)
 {
 	if(bucketName)
 		cout << bucket.name << endl;
-    list<AWS_S3_Object>::const_iterator obj;
+    AWS_S3_Catalog::const_iterator obj;
     for(obj = bucket.objects.begin(); obj != bucket.objects.end(); ++obj) {
         if(bucketName) cout << "  ";
         PrintObject(*obj);
         cout << endl;
     }
+    list<string>::const_iterator prefix;
+    for(prefix = bucket.commonPrefixes.begin(); prefix != bucket.commonPrefixes.end(); ++prefix) {
+        if(bucketName) cout << "  ";
+        cout << *prefix << endl;
+    }
+}
+
+//******************************************************************************
+// Bulk operations: commands given several objects queue one request per object
+// on an AWS_Transfer, with up to -j requests in flight at once.
+//******************************************************************************
+struct BulkIO: public AWS_IO {
+    string name;// object path, for reporting
+    bool done;
+    ofstream fout;// local file, for downloads
+    
+    BulkIO(const string & nm): name(nm), done(false) {}
+    
+    virtual void DidFinish() {
+        AWS_IO::DidFinish();
+        done = true;
+    }
+};
+
+// Copy, then duplicate the source ACL on the destination. Each step is queued
+// from the completion of the previous one.
+struct BulkCopyIO: public BulkIO {
+    AWS & aws;
+    string srcBucket, srcKey;
+    string dstBucket, dstKey;
+    int step;
+    
+    BulkCopyIO(AWS & a, const string & sb, const string & sk, const string & db, const string & dk):
+        BulkIO(sb + "/" + sk),
+        aws(a), srcBucket(sb), srcKey(sk), dstBucket(db), dstKey(dk), step(0)
+    {}
+    
+    virtual void DidFinish() {
+        AWS_Transfer * xfer = transfer;
+        if(Failure() || step == 2) {
+            BulkIO::DidFinish();
+        }
+        else if(step == 0) {
+            Reset();
+            transfer = xfer;
+            step = 1;
+            aws.GetACL(srcBucket, srcKey, *this);
+        }
+        else {
+            string acl = response.str();
+            Reset();
+            transfer = xfer;
+            step = 2;
+            aws.SetACL(dstBucket, dstKey, acl, *this);
+        }
+    }
+};
+
+size_t GetJobs(const CommandLine & cmds)
+{
+    int jobs = cmds.opts.GetWithDefault("-j", 1);
+    return (jobs < 1)? 1 : jobs;
+}
+
+// Delete completed operations from ios, reporting any that failed. Operations
+// that never made it onto the transfer (a local file could not be opened, for
+// example) count as completed. Returns the number of failures.
+int ReapBulk(list<BulkIO *> & ios, const AWS_Transfer & xfer, const string & cmd)
+{
+    int failures = 0;
+    list<BulkIO *>::iterator i = ios.begin();
+    while(i != ios.end())
+    {
+        BulkIO * io = *i;
+        if(!io->done && xfer.Queued(*io)) {
+            ++i;
+            continue;
+        }
+        if(io->Failure()) {
+            cerr << "ERROR: " << cmd << ": failed on " << io->name << endl;
+            ++failures;
+        }
+        else if(verbosity >= 2) {
+            cout << io->name << endl;
+        }
+        delete io;
+        i = ios.erase(i);
+    }
+    return failures;
+}
+
+//******************************************************************************
+// Batched deletes: keys are collected into Multi-Object Delete requests of up to
+// AWS::kMaxDeleteKeys keys, each queued on an AWS_Transfer as soon as it fills.
+// Keys may come from listings running on the same transfer, which pause while
+// the deletes are behind, so only a few batches are held at any time.
+//******************************************************************************
+struct DeleteBatchIO: public AWS_XMLIO {
+    AWS_DeleteResultParser result;
+    string cmd, bucket;
+    vector<string> keys;
+    vector<string> versionIds;
+    int & failures;
+    bool done;
+    
+    DeleteBatchIO(const string & c, const string & b, int & f):
+        AWS_XMLIO(result), cmd(c), bucket(b), failures(f), done(false)
+    {}
+    
+    virtual void DidFinish() {
+        if(Failure()) {
+            AWS_IO::DidFinish();
+            cerr << "ERROR: " << cmd << ": failed to delete " << keys.size() << " objects from " << bucket << endl;
+            failures += keys.size();
+        }
+        else {
+            list<AWS_DeleteResultParser::Error>::iterator err;
+            for(err = result.errors.begin(); err != result.errors.end(); ++err) {
+                cerr << "ERROR: " << cmd << ": failed on " << bucket << "/" << err->key
+                     << ": " << err->code << " " << err->message << endl;
+                ++failures;
+            }
+            if(verbosity >= 2)
+                cout << "deleted " << keys.size() - result.errors.size() << " objects from " << bucket << endl;
+        }
+        vector<string>().swap(keys);
+        vector<string>().swap(versionIds);
+        done = true;
+    }
+};
+
+class DeleteBatcher {
+    AWS & aws;
+    AWS_Transfer & xfer;
+    string cmd, bucket;
+    vector<string> keys;
+    vector<string> versionIds;
+    list<DeleteBatchIO *> batches;
+    int & failures;
+    
+    void Reap() {
+        list<DeleteBatchIO *>::iterator b = batches.begin();
+        while(b != batches.end()) {
+            if(!(*b)->done && xfer.Queued(**b)) {
+                ++b;
+                continue;
+            }
+            delete *b;
+            b = batches.erase(b);
+        }
+    }
+    
+  public:
+    DeleteBatcher(AWS & a, AWS_Transfer & x, const string & c, const string & b, int & f):
+        aws(a), xfer(x), cmd(c), bucket(b), failures(f)
+    {}
+    ~DeleteBatcher() {
+        list<DeleteBatchIO *>::iterator b;
+        for(b = batches.begin(); b != batches.end(); ++b)
+            delete *b;
+    }
+    
+    // Keys are only sent by Queue(), so this may be called from within a
+    // transfer's completion handlers.
+    void Add(const string & key, const string & versionId = "") {
+        keys.push_back(key);
+        versionIds.push_back(versionId);
+    }
+    
+    // Send each full batch, and a final partial one if all is set.
+    void Queue(bool all) {
+        Reap();
+        while(keys.size() >= AWS::kMaxDeleteKeys || (all && !keys.empty()))
+        {
+            DeleteBatchIO * io = new DeleteBatchIO(cmd, bucket, failures);
+            size_t n = min(keys.size(), AWS::kMaxDeleteKeys);
+            io->keys.assign(keys.begin(), keys.begin() + n);
+            io->versionIds.assign(versionIds.begin(), versionIds.begin() + n);
+            keys.erase(keys.begin(), keys.begin() + n);
+            versionIds.erase(versionIds.begin(), versionIds.begin() + n);
+            batches.push_back(io);
+            io->transfer = &xfer;
+            aws.DeleteObjects(bucket, io->keys, io->versionIds, true, *io);
+        }
+    }
+    
+    // True if there are enough batches outstanding to keep the transfer busy.
+    bool Backlogged() {
+        Reap();
+        return batches.size() >= xfer.GetMaxActive();
+    }
+};
+
+// A listing that adds keys to a DeleteBatcher a page at a time. The next page is
+// requested as soon as one is done, unless the batcher is backlogged, in which
+// case the listing is paused until FinishDeletes() restarts it.
+struct DeleteFeedIO: public AWS_XMLIO {
+    DeleteBatcher & batcher;
+    bool paused;
+    
+    DeleteFeedIO(AWS_XMLParser & p, DeleteBatcher & d):
+        AWS_XMLIO(p), batcher(d), paused(false)
+    {}
+    
+    // Request the next page
+    virtual void Start(AWS_Transfer * xfer) = 0;
+    
+  protected:
+    void Next() {
+        batcher.Queue(false);
+        if(batcher.Backlogged())
+            paused = true;
+        else
+            Start(transfer);
+    }
+};
+
+// Lists the keys starting with prefix, adding those that match pattern (or all
+// of them if there is no pattern).
+struct DeleteListIO: public DeleteFeedIO {
+    AWS & aws;
+    string bucket, prefix, pattern;
+    AWS_S3_Catalog objects;
+    AWS_ObjectListParser page;
+    string marker;
+    size_t matched;
+    
+    DeleteListIO(AWS & a, DeleteBatcher & d, const string & b, const string & pre, const string & pat):
+        DeleteFeedIO(page, d), aws(a), bucket(b), prefix(pre), pattern(pat),
+        page(objects), matched(0)
+    {}
+    
+    virtual void Start(AWS_Transfer * xfer) {
+        Reset();
+        transfer = xfer;
+        page.Reset();
+        aws.ListBucket(bucket, prefix, marker, "", 0, *this);
+    }
+    
+    virtual void DidFinish() {
+        if(Failure() || page.Failed()) {
+            AWS_IO::DidFinish();
+            cerr << "ERROR: failed to list " << bucket << "/" << prefix << endl;
+            error = true;
+            return;
+        }
+        AWS_S3_Catalog::const_iterator obj;
+        for(obj = objects.begin(); obj != objects.end(); ++obj) {
+            if(pattern == "" || fnmatch(pattern.c_str(), obj->GetKey(), 0) == 0) {
+                batcher.Add(obj->GetKey());
+                ++matched;
+            }
+        }
+        objects.clear();
+        
+        if(page.truncated && page.Marker() != "" && page.Marker() != marker) {
+            marker = page.Marker();
+            Next();
+        }
+    }
+};
+
+// Lists every version and delete marker in a bucket, adding all of them.
+struct DeleteVersionsIO: public DeleteFeedIO {
+    AWS & aws;
+    string bucket;
+    AWS_VersionListParser page;
+    string keyMarker, versionIdMarker;
+    
+    DeleteVersionsIO(AWS & a, DeleteBatcher & d, const string & b):
+        DeleteFeedIO(page, d), aws(a), bucket(b)
+    {}
+    
+    virtual void Start(AWS_Transfer * xfer) {
+        Reset();
+        transfer = xfer;
+        page.Reset();
+        aws.ListObjectVersions(bucket, "", keyMarker, versionIdMarker, *this);
+    }
+    
+    virtual void DidFinish() {
+        if(Failure() || page.Failed()) {
+            AWS_IO::DidFinish();
+            cerr << "ERROR: failed to list versions in " << bucket << endl;
+            error = true;
+            return;
+        }
+        for(size_t j = 0; j < page.keys.size(); ++j)
+            batcher.Add(page.keys[j], page.versionIds[j]);
+        
+        if(page.truncated && page.nextKeyMarker != "") {
+            keyMarker = page.nextKeyMarker;
+            versionIdMarker = page.nextVersionIdMarker;
+            Next();
+        }
+    }
+};
+
+// Run the transfer until all feeds have finished, restarting paused ones as the
+// deletes catch up, then send the remaining keys and wait for the last deletes.
+// Returns the number of feeds that failed.
+int FinishDeletes(AWS_Transfer & xfer, DeleteBatcher & batcher, list<DeleteFeedIO *> & feeds)
+{
+    while(true)
+    {
+        bool waiting = false;
+        list<DeleteFeedIO *>::iterator feed;
+        for(feed = feeds.begin(); feed != feeds.end(); ++feed) {
+            if(!(*feed)->paused)
+                continue;
+            if(batcher.Backlogged()) {
+                waiting = true;
+            }
+            else {
+                (*feed)->paused = false;
+                (*feed)->Start(&xfer);
+            }
+        }
+        if(xfer.Step() == 0 && !waiting)
+            break;
+    }
+    batcher.Queue(true);
+    xfer.Finish();
+    
+    int failures = 0;
+    list<DeleteFeedIO *>::iterator feed;
+    for(feed = feeds.begin(); feed != feeds.end(); ++feed)
+        if((*feed)->Failure())
+            ++failures;
+    return failures;
+}
+
+static bool IsGlob(const string & key)
+{
+    return key.find_first_of("*?[") != string::npos;
 }
 
 //******************************************************************************
@@ -349,6 +741,7 @@ int Command_s3install(size_t wordc, CommandLine & cmds, AWS & aws)
     cmdstrm << " && ln -s " << pwd << "/s3tool s3rm";
     cmdstrm << " && ln -s " << pwd << "/s3tool s3mkbkt";
     cmdstrm << " && ln -s " << pwd << "/s3tool s3rmbkt";
+    cmdstrm << " && ln -s " << pwd << "/s3tool s3uploads";
     cmdstrm << " && ln -s " << pwd << "/s3tool s3setacl";
     cmdstrm << " && ln -s " << pwd << "/s3tool s3getacl";
     cmdstrm << " && ln -s " << pwd << "/s3tool s3genidx";
@@ -367,6 +760,9 @@ void PrintUsage_s3ls() {
     cout << "\ts3tool -r ls" << endl;
     cout << "List contents of bucket or object from bucket:" << endl;
     cout << "\ts3tool ls BUCKET_NAME [OBJECT_KEY]" << endl;
+    cout << "List contents of a \"directory\", keys starting with OBJECT_KEY up to the next /:" << endl;
+    cout << "\ts3tool ls BUCKET_NAME OBJECT_KEY/" << endl;
+    cout << "Large buckets are listed with several requests in parallel, -j N sets how many." << endl;
     cout << "alias s3ls" << endl;
     cout << endl;
 }
@@ -376,13 +772,12 @@ int Command_s3ls(size_t wordc, CommandLine & cmds, AWS & aws)
     if(wordc == 1)
     {
         // List all buckets
-        AWS_Connection * conn = NULL;
-        list<AWS_S3_Bucket> & buckets = aws.GetBuckets(false, true, &conn);
+        list<AWS_S3_Bucket> & buckets = aws.GetBuckets(false, true);
         list<AWS_S3_Bucket>::iterator bkt;
         
         if(cmds.FlagSet("-r")) {
             for(bkt = buckets.begin(); bkt != buckets.end(); ++bkt) {
-                aws.GetBucketContents(*bkt, &conn);
+                aws.GetBucketContents(*bkt);
                 PrintBucket(*bkt, true);
             }
         }
@@ -391,7 +786,6 @@ int Command_s3ls(size_t wordc, CommandLine & cmds, AWS & aws)
             for(bkt = buckets.begin(); bkt != buckets.end(); ++bkt)
                 cout << bkt->name << endl;
         }
-        delete conn;
     }
     else if(wordc == 2 || wordc == 3)
     {
@@ -406,18 +800,20 @@ int Command_s3ls(size_t wordc, CommandLine & cmds, AWS & aws)
             aws.GetBucketContents(bucket);
             PrintBucket(bucket);
         }
+        else if(objectKey[objectKey.length() - 1] == '/')
+        {
+            // List one "directory" of bucket
+            AWS_S3_Bucket bucket(bucketName, "");
+            aws.GetBucketContents(bucket, objectKey, "/");
+            PrintBucket(bucket);
+        }
         else
         {
             // List specific object in bucket
             AWS_S3_Bucket bucket(bucketName, "");
-            aws.GetBucketContents(bucket);
-            list<AWS_S3_Object>::const_iterator obj;
-            for(obj = bucket.objects.begin(); obj != bucket.objects.end(); ++obj) {
-                if(obj->key == objectKey) {
-                    PrintObject(*obj, true);// long format, all details
-                    cout << endl;
-                    break;
-                }
+            if(aws.GetObjectInfo(bucket, objectKey)) {
+                PrintObject(bucket.objects[0], true);// long format, all details
+                cout << endl;
             }
         }
     }
@@ -436,7 +832,12 @@ void PrintUsage_s3put() {
     cout << "\ts3tool put BUCKET_NAME OBJECT_KEY [FILE_PATH] [OPTIONS]" << endl;
     cout << "\ts3tool put BUCKET_NAME/OBJECT_KEY | BUCKET_NAME:OBJECT_KEY [FILE_PATH]" << endl;
     cout << "\tOBJECT_KEY may contain / characters, allowing imitation of a directory structure" << endl;
-    cout << "[OPTIONS] = [-pPERMISSION] [-tTYPE] [-mMETADATA]" << endl;
+    cout << "\tA FILE_PATH of - uploads standard input, in parts of PART_SIZE if it is large" << endl;
+    cout << "Upload several files, appending each file name to KEY_PREFIX:" << endl;
+    cout << "\ts3tool put BUCKET_NAME/[KEY_PREFIX/] FILE_PATH... [-jJOBS] [OPTIONS]" << endl;
+    cout << "[OPTIONS] = [-pPERMISSION] [-tTYPE] [-mMETADATA] [-sPART_SIZE]" << endl;
+    cout << "JOBS: number of uploads, or parts of a large file, to send at once" << endl;
+    cout << "PART_SIZE: part size for large files, which are sent as multipart uploads, e.g. 16M" << endl;
     cout << "PERMISSION: a canned ACL:" << endl;
     cout << "\tprivate, public-read, public-read-write, or authenticated-read" << endl;
     cout << "TYPE: a MIME content-type" << endl;
@@ -445,6 +846,68 @@ void PrintUsage_s3put() {
     cout << endl;
 }
 
+void SetPutHeaders(AWS_IO & io, const CommandLine & cmds, const string & filePath)
+{
+    ParseMetadata(io, cmds);
+    if(cmds.opts.Exists("-t"))
+        io.sendHeaders.Set("Content-Type", cmds.opts.GetWithDefault("-t", ""));
+    else {
+        string inferredType = MatchMimeType(filePath);
+        if(inferredType != "")
+            io.sendHeaders.Set("Content-Type", inferredType);
+    }
+}
+
+int Command_s3put_bulk(int idx, CommandLine & cmds, AWS & aws,
+                       const string & bucketName, const string & keyPrefix, const string & acl)
+{
+    AWS_Transfer xfer(GetJobs(cmds));
+    list<BulkIO *> ios;
+    vector<string> largeFiles;
+    int failures = 0;
+    for(; idx < (int)cmds.words.size(); ++idx)
+    {
+        const string & filePath = cmds.words[idx];
+        // Pipes and other files that are not regular report no useful size, and are
+        // streamed with the large files rather than read into memory.
+        struct stat st;
+        if(stat(filePath.c_str(), &st) == 0 &&
+           (!S_ISREG(st.st_mode) || (size_t)st.st_size >= aws.GetMultipartThreshold())) {
+            largeFiles.push_back(filePath);
+            continue;
+        }
+        
+        string objectKey = keyPrefix + filePath.substr(filePath.find_last_of('/') + 1);
+        BulkIO * io = new BulkIO(bucketName + "/" + objectKey);
+        ios.push_back(io);
+        SetPutHeaders(*io, cmds, filePath);
+        io->transfer = &xfer;
+        aws.PutObject(bucketName, objectKey, acl, filePath, *io);
+        failures += ReapBulk(ios, xfer, "s3put");
+    }
+    xfer.Finish();
+    failures += ReapBulk(ios, xfer, "s3put");
+    
+    // Large files and streams go up one at a time as multipart uploads, with their
+    // parts in parallel.
+    vector<string>::iterator filePath;
+    for(filePath = largeFiles.begin(); filePath != largeFiles.end(); ++filePath)
+    {
+        string objectKey = keyPrefix + filePath->substr(filePath->find_last_of('/') + 1);
+        AWS_IO io;
+        SetPutHeaders(io, cmds, *filePath);
+        aws.PutObject(bucketName, objectKey, acl, *filePath, io);
+        if(io.Failure()) {
+            cerr << "ERROR: s3put: failed on " << bucketName << "/" << objectKey << endl;
+            ++failures;
+        }
+        else if(verbosity >= 2) {
+            cout << bucketName << "/" << objectKey << endl;
+        }
+    }
+    return (failures > 0)? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int Command_s3put(size_t wordc, CommandLine & cmds, AWS & aws)
 {
     if(wordc > 1) {
@@ -453,8 +916,22 @@ int Command_s3put(size_t wordc, CommandLine & cmds, AWS & aws)
         int idx = 1;
         ParseObjPath(idx, cmds, bucketName, objectKey);
         
-        // If there's a remaining word after the bucket/key, it's a file path
+        // Key prefix followed by files: upload each file under its own name.
+        if((objectKey == "" || objectKey[objectKey.length() - 1] == '/') && idx < (int)cmds.words.size())
+        {
+            string acl;
+            if((cmds.words[0] == "wput") || (cmds.words[0] == "s3wput"))
+                acl = "public-read";
+            cmds.opts.Get("-p", acl);
+            return Command_s3put_bulk(idx, cmds, aws, bucketName, objectKey, acl);
+        }
+        
+        // If there's a remaining word after the bucket/key, it's a file path.
+        // "-" reads the data from standard input.
+        bool fromStdin = cmds.FlagSet("-");
         string filePath = (idx < (int)cmds.words.size())? cmds.words[idx] : objectKey;
+        if(fromStdin)
+            filePath = "-";
         cout << "filePath: " << filePath << endl;
         string acl;
         
@@ -469,7 +946,7 @@ int Command_s3put(size_t wordc, CommandLine & cmds, AWS & aws)
         if(cmds.opts.Exists("-t"))
             io.sendHeaders.Set("Content-Type", cmds.opts.GetWithDefault("-t", ""));
         else {
-            string inferredType = MatchMimeType(filePath);
+            string inferredType = MatchMimeType(fromStdin? objectKey : filePath);
             if(inferredType != "")
                 io.sendHeaders.Set("Content-Type", inferredType);
         }
@@ -478,7 +955,10 @@ int Command_s3put(size_t wordc, CommandLine & cmds, AWS & aws)
         
         io.ostrm = &cout;
         io.printProgress = true;
-        aws.PutObject(bucketName, objectKey, acl, filePath, io);
+        if(fromStdin)
+            aws.PutObjectStream(bucketName, objectKey, acl, cin, io);
+        else
+            aws.PutObject(bucketName, objectKey, acl, filePath, io);
         if(io.Failure()) {
             cerr << "ERROR: failed to put object" << endl;
             cerr << "response:\n" << io << endl;
@@ -498,10 +978,40 @@ int Command_s3put(size_t wordc, CommandLine & cmds, AWS & aws)
 //******************************************************************************
 void PrintUsage_s3get() {
     cout << "Download file from S3:" << endl;
-    cout << "\ts3tool get BUCKET_NAME OBJECT_KEY [FILE_PATH]" << endl;
+    cout << "\ts3tool get BUCKET_NAME OBJECT_KEY [FILE_PATH] [-sPART_SIZE] [-jJOBS]" << endl;
+    cout << "\tLarge objects are fetched in ranges of PART_SIZE, JOBS at a time" << endl;
+    cout << "Download several objects, each to a file named by its key:" << endl;
+    cout << "\ts3tool get BUCKET_NAME: OBJECT_KEY... [-jJOBS]" << endl;
     cout << endl;
 }
 
+int Command_s3get_bulk(int idx, CommandLine & cmds, AWS & aws, const string & bucketName)
+{
+    AWS_Transfer xfer(GetJobs(cmds));
+    list<BulkIO *> ios;
+    int failures = 0;
+    for(; idx < (int)cmds.words.size(); ++idx)
+    {
+        const string & objectKey = cmds.words[idx];
+        BulkIO * io = new BulkIO(bucketName + "/" + objectKey);
+        ios.push_back(io);
+        
+        io->fout.open(objectKey.c_str(), ios_base::binary | ios_base::out);
+        if(!io->fout) {
+            cerr << "Could not write file " << objectKey << endl;
+            io->error = true;
+            continue;
+        }
+        io->ostrm = &io->fout;
+        io->transfer = &xfer;
+        aws.GetObject(bucketName, objectKey, *io);
+        failures += ReapBulk(ios, xfer, "s3get");
+    }
+    xfer.Finish();
+    failures += ReapBulk(ios, xfer, "s3get");
+    return (failures > 0)? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int Command_s3get(size_t wordc, CommandLine & cmds, AWS & aws)
 {
     if(wordc > 1) {
@@ -509,24 +1019,24 @@ int Command_s3get(size_t wordc, CommandLine & cmds, AWS & aws)
         int idx = 1;
         ParseObjPath(idx, cmds, bucketName, objectKey);
         
+        // Bucket followed by keys
+        if(objectKey == "" && idx < (int)cmds.words.size())
+            return Command_s3get_bulk(idx, cmds, aws, bucketName);
+        
         // If there's a remaining word after the bucket/key, it's a local file/directory path
         string filePath = (idx < (int)cmds.words.size())? cmds.words[idx] : objectKey;
-        ofstream fout(filePath.c_str(), ios_base::binary | ios_base::out);
         
         // TODO: if objectKey is null, get all objects in bucket, treating filePath as path prefix.
         
-        AWS_IO objinfo_io;
-        aws.GetObjectMData(bucketName, objectKey, objinfo_io);
-        
-        AWS_IO io(NULL, &fout);
+        // The size for progress and the choice of ranged download come from the
+        // GET itself, rather than a separate HEAD request.
+        AWS_IO io;
         io.printProgress = (verbosity >= 1);
-        io.bytesToGet = objinfo_io.headers.GetWithDefault("Content-Length", 0);
-        aws.GetObject(bucketName, objectKey, io);
+        aws.GetObjectFile(bucketName, objectKey, filePath, io);
         if(io.Failure()) {
             cerr << "ERROR: failed to get object" << endl;
             cerr << "response:\n" << io << endl;
-            // TODO: grab response body, delete incorrect local file,
-            // or retry
+            // TODO: grab response body, or retry
             //cerr << "response body:\n" << io.response.str() << endl;
             return EXIT_FAILURE;
         }
@@ -555,9 +1065,8 @@ int Command_s3getmeta(size_t wordc, CommandLine & cmds, AWS & aws)
         
         AWS_IO io(NULL, NULL);
         aws.GetObjectMData(bucketName, objectKey, io);
-        AWS_MultiDict::iterator i;
-        for(i = io.headers.begin(); i != io.headers.end(); ++i)
-            cout << i->first << ": " << i->second << endl;
+        for(size_t j = 0; j < io.headers.Size(); ++j)
+            cout << io.headers.Name(j) << ": " << io.headers.Value(j) << endl;
     }
     else {
         PrintUsage_s3getmeta();
@@ -663,9 +1172,40 @@ void PrintUsage_s3cp() {
     cout << "Copy S3 object:" << endl;
     cout << "\ts3tool cp SRC_BUCKET_NAME SRC_OBJECT_KEY DST_OBJECT_KEY" << endl;
     cout << "\ts3tool cp SRC_BUCKET_NAME SRC_OBJECT_KEY DST_BUCKET_NAME DST_OBJECT_KEY" << endl;
+    cout << "Copy several objects, appending each key to DST_KEY_PREFIX:" << endl;
+    cout << "\ts3tool cp SRC_BUCKET_NAME: [DST_BUCKET_NAME]:[DST_KEY_PREFIX/] OBJECT_KEY... [-jJOBS]" << endl;
     cout << endl;
 }
 
+int Command_s3cp_bulk(int idx, CommandLine & cmds, AWS & aws,
+                      const string & srcBucketName, const string & dstBucketName,
+                      const string & dstKeyPrefix)
+{
+    AWS_Transfer xfer(GetJobs(cmds));
+    list<BulkIO *> ios;
+    int failures = 0;
+    for(; idx < (int)cmds.words.size(); ++idx)
+    {
+        const string & objectKey = cmds.words[idx];
+        BulkCopyIO * io = new BulkCopyIO(aws, srcBucketName, objectKey,
+                                         dstBucketName, dstKeyPrefix + objectKey);
+        ios.push_back(io);
+        
+        bool copyMD = true;
+        if(cmds.opts.Exists("-t")) {
+            io->sendHeaders.Set("Content-Type", cmds.opts.GetWithDefault("-t", ""));
+            copyMD = false;
+        }
+        ParseMetadata(*io, cmds);
+        io->transfer = &xfer;
+        aws.CopyObject(srcBucketName, objectKey, dstBucketName, dstKeyPrefix + objectKey, copyMD, *io);
+        failures += ReapBulk(ios, xfer, "s3cp");
+    }
+    xfer.Finish();
+    failures += ReapBulk(ios, xfer, "s3cp");
+    return (failures > 0)? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int Command_s3cp(size_t wordc, CommandLine & cmds, AWS & aws)
 {
     if(wordc > 1) {
@@ -676,6 +1216,11 @@ int Command_s3cp(size_t wordc, CommandLine & cmds, AWS & aws)
         ParseObjPath(idx, cmds, dstBucketName, dstObjectKey);
         if(dstBucketName == "")
             dstBucketName = srcBucketName;
+        
+        // Source bucket, destination bucket and key prefix, followed by keys
+        if(srcObjectKey == "" && idx < (int)cmds.words.size())
+            return Command_s3cp_bulk(idx, cmds, aws, srcBucketName, dstBucketName, dstObjectKey);
+        
         if(dstObjectKey == "")
             dstObjectKey = srcObjectKey;
         
@@ -796,7 +1341,13 @@ int Command_s3mv(size_t wordc, CommandLine & cmds, AWS & aws)
 //******************************************************************************
 void PrintUsage_s3rm() {
     cout << "Remove object:" << endl;
-    cout << "\ts3 rm BUCKET_NAME OBJECT_KEY" << endl;
+    cout << "\ts3 rm BUCKET_NAME OBJECT_KEY... [-jJOBS]" << endl;
+    cout << "Remove objects with keys matching a pattern (quote it from the shell):" << endl;
+    cout << "\ts3 rm BUCKET_NAME 'PATTERN'... [-jJOBS]" << endl;
+    cout << "Remove all objects with keys starting with prefix, or all objects in bucket:" << endl;
+    cout << "\ts3 rm -r BUCKET_NAME [KEY_PREFIX...] [-jJOBS]" << endl;
+    cout << "Remove objects with keys read from standard input, one per line:" << endl;
+    cout << "\ts3 rm BUCKET_NAME - [-jJOBS]" << endl;
     cout << endl;
 }
 
@@ -807,6 +1358,75 @@ int Command_s3rm(size_t wordc, CommandLine & cmds, AWS & aws)
         int idx = 1;
         ParseObjPath(idx, cmds, bucketName, objectKey);
         // TODO: rm bucket when only bucket specified?
+        
+        vector<string> keys;
+        if(objectKey != "")
+            keys.push_back(objectKey);
+        for(; idx < (int)cmds.words.size(); ++idx)
+            keys.push_back(cmds.words[idx]);
+        
+        bool recursive = cmds.FlagSet("-r");
+        bool fromStdin = cmds.FlagSet("-");
+        if(keys.size() > 1 || recursive || fromStdin || (keys.size() == 1 && IsGlob(keys[0])))
+        {
+            // Keys from globs and prefixes are deleted as they are listed, on the
+            // same transfer, which has an extra slot for the listings.
+            AWS_Transfer xfer(GetJobs(cmds) + 1);
+            int failures = 0;
+            DeleteBatcher batcher(aws, xfer, "s3rm", bucketName, failures);
+            if(recursive && keys.empty())
+                keys.push_back("");// entire bucket
+            
+            list<DeleteListIO *> listings;
+            list<DeleteFeedIO *> feeds;
+            vector<string>::iterator key;
+            for(key = keys.begin(); key != keys.end(); ++key)
+            {
+                if(IsGlob(*key)) {
+                    string prefix = key->substr(0, key->find_first_of("*?["));
+                    listings.push_back(new DeleteListIO(aws, batcher, bucketName, prefix, *key));
+                }
+                else if(recursive) {
+                    listings.push_back(new DeleteListIO(aws, batcher, bucketName, *key, ""));
+                }
+                else {
+                    batcher.Add(*key);
+                    batcher.Queue(false);
+                    continue;
+                }
+                feeds.push_back(listings.back());
+                listings.back()->Start(&xfer);
+            }
+            
+            if(fromStdin) {
+                // One key per line
+                string line;
+                while(getline(cin, line)) {
+                    if(line != "" && line[line.length() - 1] == '\r')
+                        line.erase(line.length() - 1);
+                    if(line != "") {
+                        batcher.Add(line);
+                        batcher.Queue(false);
+                    }
+                }
+            }
+            
+            failures += FinishDeletes(xfer, batcher, feeds);
+            
+            list<DeleteListIO *>::iterator listing;
+            for(listing = listings.begin(); listing != listings.end(); ++listing) {
+                if((*listing)->Success() && (*listing)->matched == 0 && (*listing)->pattern != "") {
+                    cerr << "ERROR: s3rm: no keys match " << bucketName << "/" << (*listing)->pattern << endl;
+                    ++failures;
+                }
+                delete *listing;
+            }
+            return (failures > 0)? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        else if(keys.size() == 1) {
+            objectKey = keys[0];
+        }
+        
         AWS_IO io;
         aws.DeleteObject(bucketName, objectKey, io);
         if(io.Failure()) {
@@ -857,6 +1477,8 @@ int Command_s3mkbkt(size_t wordc, CommandLine & cmds, AWS & aws)
 void PrintUsage_s3rmbkt() {
     cout << "Remove bucket:" << endl;
     cout << "\ts3tool rmbkt BUCKET_NAME" << endl;
+    cout << "Remove bucket with all of its objects, including all versions of them:" << endl;
+    cout << "\ts3tool rmbkt -f BUCKET_NAME [-jJOBS]" << endl;
     cout << endl;
 }
 
@@ -864,6 +1486,23 @@ int Command_s3rmbkt(size_t wordc, CommandLine & cmds, AWS & aws)
 {
     if(wordc == 2) {
         string bucketName = cmds.words[1];
+        
+        if(cmds.FlagSet("-f")) {
+            // Empty the bucket first. Versions are deleted as they are listed.
+            AWS_Transfer xfer(GetJobs(cmds) + 1);
+            int failures = 0;
+            DeleteBatcher batcher(aws, xfer, "s3rmbkt", bucketName, failures);
+            DeleteVersionsIO versions(aws, batcher, bucketName);
+            list<DeleteFeedIO *> feeds;
+            feeds.push_back(&versions);
+            versions.Start(&xfer);
+            failures += FinishDeletes(xfer, batcher, feeds);
+            if(failures > 0) {
+                cerr << "ERROR: s3rmbkt: could not empty bucket " << bucketName << endl;
+                return EXIT_FAILURE;
+            }
+        }
+        
         AWS_IO io;
         aws.DeleteBucket(bucketName, io);
         if(io.Failure()) {
@@ -879,6 +1518,77 @@ int Command_s3rmbkt(size_t wordc, CommandLine & cmds, AWS & aws)
     return EXIT_SUCCESS;
 }
 
+//******************************************************************************
+// MARK: uploads
+//******************************************************************************
+void PrintUsage_s3uploads() {
+    cout << "List multipart uploads in progress, optionally only those started at least DAYS ago:" << endl;
+    cout << "\ts3tool uploads BUCKET_NAME [KEY_PREFIX] [-dDAYS]" << endl;
+    cout << "Abort them, deleting the parts already sent:" << endl;
+    cout << "\ts3tool uploads -a BUCKET_NAME [KEY_PREFIX] [-dDAYS]" << endl;
+    cout << endl;
+}
+
+int Command_s3uploads(size_t wordc, CommandLine & cmds, AWS & aws)
+{
+    if(wordc == 2 || wordc == 3) {
+        string bucketName = cmds.words[1];
+        string prefix = (wordc == 3)? cmds.words[2] : "";
+        bool abort = cmds.FlagSet("-a");
+        double days = cmds.opts.GetWithDefault("-d", 0.0);
+        time_t cutoff = time(NULL) - (time_t)(days*86400);
+        
+        int failures = 0;
+        AWS_UploadListParser parser;
+        string keyMarker, uploadIdMarker;
+        do {
+            parser.Reset();
+            AWS_XMLIO io(parser);
+            aws.ListMultipartUploads(bucketName, prefix, keyMarker, uploadIdMarker, io);
+            if(io.Failure()) {
+                cerr << "ERROR: failed to list uploads" << endl;
+                cerr << "response:\n" << io << endl;
+                cerr << "response body:\n" << io.response.str() << endl;
+                return EXIT_FAILURE;
+            }
+            
+            list<AWS_UploadListParser::Upload>::iterator upload;
+            for(upload = parser.uploads.begin(); upload != parser.uploads.end(); ++upload)
+            {
+                // An upload that can not be dated is never taken as old enough
+                int64_t initiated;
+                if(days > 0 && !ParseTimestamp(initiated, upload->initiated)) {
+                    cerr << "WARNING: s3uploads: skipping " << upload->uploadId << " of " << upload->key
+                         << ", unreadable Initiated time \"" << upload->initiated << "\"" << endl;
+                    continue;
+                }
+                if(days > 0 && initiated/1000 > cutoff)
+                    continue;
+                cout << upload->key << " " << upload->uploadId << " " << upload->initiated << endl;
+                if(abort) {
+                    AWS_IO abortIO;
+                    aws.AbortMultipartUpload(bucketName, upload->key, upload->uploadId, abortIO);
+                    if(abortIO.Failure()) {
+                        cerr << "ERROR: s3uploads: could not abort " << upload->uploadId
+                             << " of " << upload->key << endl;
+                        ++failures;
+                    }
+                }
+            }
+        } while(parser.NextPage(keyMarker, uploadIdMarker));
+        if(parser.truncated) {
+            cerr << "ERROR: s3uploads: listing truncated without a marker to continue from" << endl;
+            ++failures;
+        }
+        
+        return (failures > 0)? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    else {
+        PrintUsage_s3uploads();
+    }
+    return EXIT_SUCCESS;
+}
+
 //******************************************************************************
 // MARK: setacl, setbktacl
 //******************************************************************************
@@ -1025,26 +1735,27 @@ int Command_s3genidx(size_t wordc, CommandLine & cmds, AWS & aws)
     strm << "<table>\n";
     strm << "<tr><th>Name</th><th>Last modified</th><th>Size</th><th>eTag</th></tr>\n";
     strm << "<tr><th colspan=\"4\"><hr></th></tr>\n";
-    list<AWS_S3_Object>::const_iterator obj;
+    AWS_S3_Catalog::const_iterator obj;
     for(obj = bucket.objects.begin(); obj != bucket.objects.end(); ++obj)
     {
-        if(obj->key == "index.html")
+        string key(obj->GetKey(), obj->GetKeyLength());
+        if(key == "index.html")
             continue;
         
-        S3_ACL perms(aws.GetACL(bucket.name, obj->key, io));
+        S3_ACL perms(aws.GetACL(bucket.name, key, io));
         if(!perms.all.read) {
-            cout << bucket.name << ":" << obj->key << " is not publically readable" << endl;
+            cout << bucket.name << ":" << key << " is not publically readable" << endl;
             continue;
         }
-        //cout << bucket.name << ":" << obj->key << endl;
+        //cout << bucket.name << ":" << key << endl;
         //cout << "\tAll " << perms.all << endl;
         //cout << "\tAuth " << perms.auth << endl;
         strm << "<tr>";
-        strm << "<td><a href=\"http://" << bucket.name << "/" << obj->key << "\">"
-             << obj->key << "</a></td>";
-        strm << "<td>" << obj->lastModified << "</td>";
+        strm << "<td><a href=\"http://" << bucket.name << "/" << key << "\">"
+             << key << "</a></td>";
+        strm << "<td>" << obj->GetLastModified() << "</td>";
         strm << "<td>" << HumanSize(obj->GetSize()) << "</td>";
-        strm << "<td>" << obj->eTag << "</td>";
+        strm << "<td>" << obj->GetETag() << "</td>";
         strm << "</tr>\n";
     }
     strm << "</table>\n";
@@ -1124,6 +1835,9 @@ void InitCommands()
     commands["s3rmbkt"] = Command_s3rmbkt;
     commands["rmbkt"] = Command_s3rmbkt;
     
+    commands["s3uploads"] = Command_s3uploads;
+    commands["uploads"] = Command_s3uploads;
+    
     commands["s3setbktacl"] = Command_s3setbktacl;
     commands["setbktacl"] = Command_s3setbktacl;
     
@@ -1152,6 +1866,7 @@ void PrintUsage() {
     PrintUsage_s3rm();
     PrintUsage_s3mkbkt();
     PrintUsage_s3rmbkt();
+    PrintUsage_s3uploads();
     PrintUsage_s3setacl();
     PrintUsage_s3getacl();
     PrintUsage_s3genidx();
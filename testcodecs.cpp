@@ -0,0 +1,228 @@
+//    Copyright (c) 2010, Christopher James Huff
+//    All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//  * Redistributions of source code must retain the above copyright
+//  notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//  notice, this list of conditions and the following disclaimer in the
+//  documentation and/or other materials provided with the distribution.
+//  * Neither the name of the copyright holders nor the names of contributors
+//  may be used to endorse or promote products derived from this software
+//  without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//******************************************************************************
+
+// Round trip fuzz tests of the base 64 and hex codecs, checked against OpenSSL's
+// base 64 and a plain reference for hex. Built and run by "make test". An
+// optional argument gives the random seed. Exits with status 1 on any failure.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+
+#include "aws_s3_codec.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void Fail(const char * what, const string & input)
+{
+    if(++failures <= 10)
+        fprintf(stderr, "FAIL %s: \"%s\"\n", what, input.c_str());
+}
+
+static string Printable(const uint8_t * data, size_t length)
+{
+    string hex(2*length, '\0');
+    for(size_t j = 0; j < length; ++j)
+        snprintf(&hex[2*j], 3, "%02x", data[j]);// snprintf terminates within the string
+    return hex;
+}
+
+// The data of a vector, which may be empty
+static const uint8_t * Bytes(const vector<uint8_t> & data)
+{
+    static const uint8_t none = 0;
+    return data.empty()? &none : &data[0];
+}
+
+static void RandomBytes(vector<uint8_t> & data, size_t length)
+{
+    data.resize(length);
+    for(size_t j = 0; j < length; ++j)
+        data[j] = rand() & 0xFF;
+}
+
+//******************************************************************************
+
+// Encoding must match OpenSSL's exactly, and decode back to the input
+static void TestB64RoundTrip(const vector<uint8_t> & data)
+{
+    const uint8_t * in = Bytes(data);
+    size_t length = data.size();
+    vector<char> ours(B64EncodedLength(length) + 1), theirs(B64EncodedLength(length) + 1);
+    size_t n = EncodeB64(&ours[0], in, length);
+    int m = EVP_EncodeBlock((uint8_t *)&theirs[0], in, length);
+    if(n != (size_t)m || memcmp(&ours[0], &theirs[0], n) != 0) {
+        Fail("base 64 encoding differs from OpenSSL", Printable(in, length));
+        return;
+    }
+    
+    vector<uint8_t> decoded(B64DecodedLength(n) + 1);
+    size_t d = DecodeB64(&decoded[0], &ours[0], n);
+    if(d != length || memcmp(&decoded[0], in, length) != 0)
+        Fail("base 64 round trip", string(&ours[0], n));
+    
+    if(EncodeB64(in, length) != string(&ours[0], n))
+        Fail("base 64 string encoding", Printable(in, length));
+}
+
+// Corrupted text must be rejected exactly when OpenSSL rejects it, and decode to
+// the same bytes otherwise. OpenSSL skips surrounding whitespace, which this
+// decoder does not, and gives padding as zero bytes.
+static void TestB64Corrupt(const vector<uint8_t> & data)
+{
+    string text = EncodeB64(Bytes(data), data.size());
+    if(text.empty())
+        return;
+    int changes = 1 + rand()%3;
+    for(int j = 0; j < changes; ++j) {
+        int c = (rand()%4 == 0)? '=' : rand() & 0xFF;
+        text[rand()%text.length()] = c;
+    }
+    if(isspace((uint8_t)text[0]) || isspace((uint8_t)text[text.length() - 1]))
+        return;
+    
+    vector<uint8_t> ours(B64DecodedLength(text.length()) + 1), theirs(text.length() + 1);
+    size_t n = DecodeB64(&ours[0], text.data(), text.length());
+    int m = EVP_DecodeBlock(&theirs[0], (const uint8_t *)text.data(), text.length());
+    if(m < 0) {
+        if(n != kInvalidEncoding)
+            Fail("base 64 accepted text OpenSSL rejects", text);
+        return;
+    }
+    // OpenSSL accepts padding anywhere in the last group, as zero bits
+    size_t pad = 0;
+    while(pad < 2 && text[text.length() - 1 - pad] == '=')
+        ++pad;
+    bool padded = text.find('=') == string::npos || text.find('=') == text.length() - pad;
+    if(n == kInvalidEncoding) {
+        if(padded)
+            Fail("base 64 rejected text OpenSSL accepts", text);
+        return;
+    }
+    if(!padded || n != (size_t)m - pad || memcmp(&ours[0], &theirs[0], n) != 0)
+        Fail("base 64 decoding differs from OpenSSL", text);
+}
+
+//******************************************************************************
+
+static void TestHexRoundTrip(const vector<uint8_t> & data)
+{
+    const uint8_t * in = Bytes(data);
+    size_t length = data.size();
+    string expected = Printable(in, length);
+    vector<char> ours(2*length + 1);
+    size_t n = EncodeHex(&ours[0], in, length);
+    if(n != 2*length || memcmp(&ours[0], expected.data(), n) != 0) {
+        Fail("hex encoding", expected);
+        return;
+    }
+    if(EncodeHex(in, length) != expected)
+        Fail("hex string encoding", expected);
+    
+    // Upper case decodes the same
+    string upper = expected;
+    for(size_t j = 0; j < upper.length(); ++j)
+        if(rand()%2) upper[j] = toupper(upper[j]);
+    vector<uint8_t> decoded(length + 1);
+    size_t d = DecodeHex(&decoded[0], upper.data(), upper.length());
+    if(d != length || memcmp(&decoded[0], in, length) != 0)
+        Fail("hex round trip", upper);
+}
+
+static void TestHexCorrupt(const vector<uint8_t> & data)
+{
+    string text = Printable(Bytes(data), data.size());
+    if(text.empty())
+        return;
+    text[rand()%text.length()] = rand() & 0xFF;
+    if(rand()%8 == 0)
+        text.erase(rand()%text.length(), 1);
+    
+    bool valid = text.length()%2 == 0;
+    for(size_t j = 0; j < text.length(); ++j)
+        valid = valid && isxdigit((uint8_t)text[j]);
+    
+    vector<uint8_t> decoded(text.length()/2 + 1);
+    size_t n = DecodeHex(&decoded[0], text.data(), text.length());
+    if(!valid) {
+        if(n != kInvalidEncoding)
+            Fail("hex accepted invalid text", text);
+        return;
+    }
+    bool same = n == text.length()/2;
+    for(size_t j = 0; same && j < n; ++j)
+        same = decoded[j] == strtoul(text.substr(2*j, 2).c_str(), NULL, 16);
+    if(!same)
+        Fail("hex decoding", text);
+}
+
+//******************************************************************************
+
+int main(int argc, char * argv[])
+{
+    unsigned seed = (argc > 1)? strtoul(argv[1], NULL, 10) : 1;
+    srand(seed);
+    
+#if defined(__SSSE3__)
+    // The SSSE3 build made by "make test" can only run on a CPU that has it
+    if(!__builtin_cpu_supports("ssse3")) {
+        printf("codec tests skipped, no SSSE3\n");
+        return 0;
+    }
+    const char * paths = "SSSE3";
+#elif defined(__SSE2__)
+    const char * paths = "SSE2";
+#else
+    const char * paths = "scalar";
+#endif
+    
+    // Every short length, for the scalar tails and padding, then longer inputs
+    // through the vector loops.
+    vector<uint8_t> data;
+    int tests = 0;
+    for(int iter = 0; iter < 20000; ++iter, ++tests) {
+        size_t length = (iter < 2000)? iter%100 : rand()%((iter%100 == 0)? 70000 : 600);
+        RandomBytes(data, length);
+        TestB64RoundTrip(data);
+        TestB64Corrupt(data);
+        TestHexRoundTrip(data);
+        TestHexCorrupt(data);
+    }
+    
+    if(failures > 0) {
+        fprintf(stderr, "%d of %d codec tests failed (%s), seed %u\n", failures, tests, paths, seed);
+        return 1;
+    }
+    printf("%d codec tests passed (%s), seed %u\n", tests, paths, seed);
+    return 0;
+}
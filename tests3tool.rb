@@ -52,12 +52,14 @@ puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 puts "Putting spark.png"
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 run("./s3put #{BUCKET_NAME} spark.png")
+run("cat spark.png | ./s3put #{BUCKET_NAME} sparkstream.png -")
 
 puts ""
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 puts "Listing #{BUCKET_NAME}"
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 run("./s3ls #{BUCKET_NAME}")
+run("./s3ls -j8 #{BUCKET_NAME}")
 
 puts ""
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
@@ -101,6 +103,27 @@ puts "Getting metadata for #{BUCKET_NAME} sparkcopy.png"
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 run("./s3getmeta #{BUCKET_NAME} sparkcopy.png")
 
+puts ""
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+puts "Bulk copying #{BUCKET_NAME}/sparkcopy.png and sparkoriginal.png to #{BUCKET_NAME}/bulk/"
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+run("./s3cp #{BUCKET_NAME}: #{BUCKET_NAME}:bulk/ sparkcopy.png sparkoriginal.png -j2")
+run("./s3ls #{BUCKET_NAME} bulk/")
+
+puts ""
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+puts "Bulk removing #{BUCKET_NAME}/bulk/"
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+run("./s3rm #{BUCKET_NAME} bulk/sparkcopy.png bulk/sparkoriginal.png -j2")
+
+puts ""
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+puts "Removing #{BUCKET_NAME}/bulk/ by pattern and by prefix"
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+run("./s3cp #{BUCKET_NAME}: #{BUCKET_NAME}:bulk/ sparkcopy.png sparkoriginal.png -j2")
+run("./s3rm #{BUCKET_NAME} 'bulk/*copy.png'")
+run("./s3rm -r #{BUCKET_NAME} bulk/ -j2")
+
 # TODO:
 # bucket to bucket move/copy
 
@@ -119,6 +142,13 @@ puts "Removing objects"
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 run("./s3rm #{BUCKET_NAME} sparkoriginal.png")
 run("./s3rm #{BUCKET_NAME} sparkcopy.png")
+run("./s3rm #{BUCKET_NAME} sparkstream.png")
+
+puts ""
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+puts "Listing multipart uploads"
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+run("./s3uploads #{BUCKET_NAME}")
 
 puts ""
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
@@ -126,6 +156,14 @@ puts "Removing bucket"
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 run("./s3rmbkt #{BUCKET_NAME}")
 
+puts ""
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+puts "Force removing non-empty bucket #{BUCKET_NAME}-f"
+puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
+run("./s3mkbkt #{BUCKET_NAME}-f")
+run("./s3put #{BUCKET_NAME}-f spark.png")
+run("./s3rmbkt -f #{BUCKET_NAME}-f")
+
 puts ""
 puts "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 puts "Listing all buckets"